@@ -9,8 +9,12 @@
 #include <eosiolib/time.hpp>
 #include <eosiolib/privileged.hpp>
 #include <eosiolib/singleton.hpp>
+#include <eosiolib/binary_extension.hpp>
 #include <eosio.system/exchange_state.hpp>
+#include <eosio.system/vote_weight.hpp>
+#include <eosio.system/producer_ids.hpp>
 
+#include <limits>
 #include <string>
 #include <type_traits>
 #include <optional>
@@ -120,6 +124,78 @@ namespace eosiosystem {
       EOSLIB_SERIALIZE( eosio_global_state3, (last_vpay_state_update)(total_vpay_share_change_rate) )
    };
 
+   /**
+    * Defines new global state parameters added after version 1.5
+    */
+   struct [[eosio::table("global4"), eosio::contract("eosio.system")]] eosio_global_state4 {
+      eosio_global_state4() { }
+
+      /// order of the producers in a proposed schedule
+      enum class schedule_orders : uint8_t {
+         by_name     = 0, ///< by producer name
+         by_location = 1  ///< by location, so that producers at the same location follow each other, then by name
+      };
+
+      capi_checksum256  last_proposed_schedule_hash{}; ///< fingerprint of the producer set last passed to set_proposed_producers
+      uint8_t           recalc_phase = 0;              ///< 0 when idle, 1 while recalcvotes sums voters, 2 while it writes producer tallies
+      name              recalc_cursor;                 ///< next voter (phase 1) or producer (phase 2) to be processed by recalcvotes
+      int128_t          recalc_total_vote_units = 0;   ///< sum of the producer tallies written so far in phase 2
+      int128_t          total_producer_vote_units = 0; ///< the sum of all producer votes, copied to total_producer_vote_weight like the per block counters
+      uint32_t          vote_epoch = 0;                ///< whole years (52 weeks) since the block timestamp epoch that vote weights are relative to
+      bool              rebasing = false;              ///< whether active producers are still being rebased to vote_epoch
+      name              rebase_cursor;                 ///< next producer to be rebased
+      name              count_cursor;                  ///< voters below it are counted in votecounts while buildcounts is in progress
+      bool              counts_built = false;          ///< whether votecounts covers all voters
+      uint16_t          vote_refreshes_per_block = 0;  ///< stale voters whose vote weight onblock refreshes, set by setrefresh
+      bool              aging = false;                 ///< whether onblock is still recording the vote ages of voters that voted while refreshing was disabled
+      name              age_cursor;                    ///< next voter whose vote age is recorded
+      uint32_t          next_producer_id = 0;          ///< id assigned to the next producer without one, ids are never reused
+      uint64_t          vote_event_seq = 0;            ///< sequence number of the next vote event
+      uint8_t           schedule_order = 0;            ///< one of schedule_orders, set by setschedmode
+      uint16_t          schedule_size = 21;            ///< maximum number of producers elected into a schedule, set by setelection
+      uint32_t          schedule_update_slots = 120;   ///< block slots between elections, set by setelection
+      name              top_bid_name;                  ///< name with the highest open bid, the first in the highbid index
+      int64_t           top_bid = 0;                   ///< the highest open bid, 0 if there is no open bid
+      time_point        top_bid_time;                  ///< last_bid_time of the highest open bid
+
+      EOSLIB_SERIALIZE( eosio_global_state4, (last_proposed_schedule_hash)(recalc_phase)(recalc_cursor)
+                        (recalc_total_vote_units)(total_producer_vote_units)(vote_epoch)
+                        (rebasing)(rebase_cursor)(count_cursor)(counts_built)(vote_refreshes_per_block)
+                        (aging)(age_cursor)(next_producer_id)(vote_event_seq)(schedule_order)(schedule_size)(schedule_update_slots)
+                        (top_bid_name)(top_bid)(top_bid_time) )
+   };
+
+   /**
+    *  Blocks produced by a producer in the current round that are not in its producers row yet.
+    */
+   struct round_unpaid_blocks {
+      name              producer;
+      uint32_t          unpaid_blocks = 0;
+
+      EOSLIB_SERIALIZE( round_unpaid_blocks, (producer)(unpaid_blocks) )
+   };
+
+   /**
+    *  Counters that change in every block, kept in a small row of their own so that onblock does not rewrite
+    *  eosio_global_state and its blockchain parameters. The copies of these counters in global and global2
+    *  keep their layout for existing readers and are refreshed at every election and whenever those rows
+    *  are written.
+    *
+    *  The unpaid blocks of the producers of the current round are counted here, in the order in which the
+    *  producers first produced, and added to the producers rows when a new schedule is proposed, when the
+    *  round holds a full schedule and another producer produces, or when the producer claims its rewards.
+    */
+   struct [[eosio::table("global5"), eosio::contract("eosio.system")]] eosio_global_state5 {
+      eosio_global_state5() { }
+      block_timestamp   last_producer_schedule_update;
+      uint32_t          total_unpaid_blocks = 0;       ///< all blocks which have been produced but not paid
+      block_timestamp   last_block_num;                ///< deprecated
+      std::vector<round_unpaid_blocks> round_blocks;   ///< unpaid blocks of the current round, at most one full schedule
+
+      EOSLIB_SERIALIZE( eosio_global_state5, (last_producer_schedule_update)(total_unpaid_blocks)(last_block_num)
+                        (round_blocks) )
+   };
+
    struct [[eosio::table, eosio::contract("eosio.system")]] producer_info {
       name                  owner;
       double                total_votes = 0;
@@ -130,16 +206,97 @@ namespace eosiosystem {
       time_point            last_claim_time;
       uint16_t              location = 0;
 
+      /**
+       *  Row layout version: 1 once the votepay fields below are stored in this row instead of in the
+       *  legacy producers2 table, 2 once total_vote_units holds the tally that total_votes mirrors,
+       *  3 once vote_epoch records the vote epoch that the votes and votepay share are relative to,
+       *  4 once producer_id holds the id by which voters list the producer. Rows without vote_epoch
+       *  are relative to epoch 0.
+       */
+      eosio::binary_extension<uint8_t>     version;
+      eosio::binary_extension<double>      votepay_share;
+      eosio::binary_extension<time_point>  last_votepay_share_update;
+      eosio::binary_extension<int128_t>    total_vote_units;
+      eosio::binary_extension<uint32_t>    vote_epoch;
+      eosio::binary_extension<uint32_t>    producer_id;
+
       uint64_t primary_key()const { return owner.value;                             }
-      double   by_votes()const    { return is_active ? -total_votes : total_votes;  }
+      /// active producers by votes, then inactive producers, whose key stays the same when their votes change
+      double   by_votes()const    { return is_active ? -total_votes : std::numeric_limits<double>::max(); }
       bool     active()const      { return is_active;                               }
       void     deactivate()       { producer_key = public_key(); is_active = false; }
 
+      /// rows extended before their votepay state started hold a zero last_votepay_share_update
+      bool     has_votepay_share()const {
+         return version.has_value() && last_votepay_share_update.value() != time_point();
+      }
+      void     set_votepay_share( double share, time_point update ) {
+         if( !version.has_value() )
+            version.emplace( uint8_t(1) );
+         votepay_share.emplace( share );
+         last_votepay_share_update.emplace( update );
+      }
+
+      /// rows older than version 2 derive their tally from total_votes
+      int128_t vote_units()const {
+         return total_vote_units.has_value() ? total_vote_units.value() : to_vote_units( total_votes );
+      }
+      /// rows without votepay state are extended with an empty one
+      void     set_vote_units( int128_t units ) {
+         total_votes = from_vote_units( units );
+         if( !version.has_value() )
+            set_votepay_share( 0.0, time_point() );
+         if( version.value() < 2 )
+            version.emplace( uint8_t(2) );
+         total_vote_units.emplace( units );
+      }
+
+      uint32_t votes_epoch()const { return vote_epoch.has_value() ? vote_epoch.value() : 0; }
+      /// scales the votes and the votepay share of the row down to the given, later, vote epoch
+      void     rebase_votes( uint32_t epoch ) {
+         const uint32_t years = epoch - votes_epoch();
+         set_vote_units( rebase_vote_units( vote_units(), years ) );
+         votepay_share.emplace( std::ldexp( votepay_share.value(), -int(years) ) );
+         if( version.value() < 3 )
+            version.emplace( uint8_t(3) );
+         vote_epoch.emplace( epoch );
+      }
+
+      /// rows older than version 3 are extended up to vote_epoch first
+      void     set_producer_id( uint32_t id ) {
+         if( !vote_epoch.has_value() )
+            rebase_votes( votes_epoch() );
+         version.emplace( uint8_t(4) );
+         producer_id.emplace( id );
+      }
+
       // explicit serialization macro is not necessary, used here only to improve compilation time
       EOSLIB_SERIALIZE( producer_info, (owner)(total_votes)(producer_key)(is_active)(url)
-                        (unpaid_blocks)(last_claim_time)(location) )
+                        (unpaid_blocks)(last_claim_time)(location)
+                        (version)(votepay_share)(last_votepay_share_update)(total_vote_units)(vote_epoch)
+                        (producer_id) )
    };
 
+   /**
+    *  Registry of the dense ids by which voter rows list the producers they vote for. A producer gets an id
+    *  when it registers or is first voted for. Rows are never erased, so that every id stays resolvable.
+    */
+   struct [[eosio::table, eosio::contract("eosio.system")]] producer_id_info {
+      uint64_t            id = 0;
+      name                owner;
+
+      uint64_t primary_key()const { return id; }
+
+      // explicit serialization macro is not necessary, used here only to improve compilation time
+      EOSLIB_SERIALIZE( producer_id_info, (id)(owner) )
+   };
+
+   typedef eosio::multi_index< "producerids"_n, producer_id_info > producer_ids_table;
+
+   /**
+    *  Legacy location of the votepay state of a producer. Rows are moved into producer_info
+    *  when the producer is next touched or by the migrateprods action.
+    */
    struct [[eosio::table, eosio::contract("eosio.system")]] producer_info2 {
       name            owner;
       double          votepay_share = 0;
@@ -154,7 +311,7 @@ namespace eosiosystem {
    struct [[eosio::table, eosio::contract("eosio.system")]] voter_info {
       name                owner;     /// the voter
       name                proxy;     /// the proxy set by the voter, if any
-      std::vector<name>   producers; /// the producers approved by this voter if no proxy set
+      std::vector<name>   producers; /// the producers approved by this voter if no proxy set, empty in rows of version 1
       int64_t             staked = 0;
 
       /**
@@ -163,21 +320,78 @@ namespace eosiosystem {
        *
        *  stated.amount * 2 ^ ( weeks_since_launch/weeks_per_year)
        */
-      double              last_vote_weight = 0; /// the vote weight cast the last time the vote was updated
+      double              last_vote_weight = 0; /// the vote weight cast the last time the vote was updated, mirrors last_vote_units
 
       /**
        * Total vote weight delegated to this voter.
        */
-      double              proxied_vote_weight= 0; /// the total vote weight delegated to this voter as a proxy
+      double              proxied_vote_weight= 0; /// the total vote weight delegated to this voter as a proxy, mirrors proxied_vote_units
       bool                is_proxy = 0; /// whether the voter is a proxy for others
 
 
       uint32_t            flags1 = 0;
-      uint32_t            reserved2 = 0;
+      uint32_t            vote_epoch = 0; /// the vote epoch that last_vote_weight and proxied_vote_weight are relative to
       eosio::asset        reserved3;
 
+      /**
+       *  The vote weights in whole vote units, so that the weight delegated to a proxy is the exact sum of the
+       *  weights of its delegators. Rows without them derive them from the doubles until they are next written.
+       */
+      eosio::binary_extension<int128_t>  last_vote_units;
+      eosio::binary_extension<int128_t>  proxied_vote_units;
+
+      /**
+       *  Row layout version: 1 once the producers voted for are listed in producer_ids, by their ids in the
+       *  producerids registry encoded with encode_producer_ids, instead of by name in producers. Rows are
+       *  converted when their vote is next cast.
+       */
+      eosio::binary_extension<uint8_t>            version;
+      eosio::binary_extension<std::vector<char>>  producer_ids;
+
       uint64_t primary_key()const { return owner.value; }
 
+      bool     lists_producer_ids()const { return version.has_value() && version.value() >= 1; }
+      /// whether the row votes for any producer, by name or by id
+      bool     has_producers()const {
+         return lists_producer_ids() ? !producer_ids.value().empty() : !producers.empty();
+      }
+      /// converts the row to version 1, extending it with the vote units first
+      void     set_producer_ids( const std::vector<uint32_t>& ids ) {
+         last_vote_units.emplace( vote_units() );
+         proxied_vote_units.emplace( proxied_units() );
+         version.emplace( uint8_t(1) );
+         producer_ids.emplace( encode_producer_ids( ids ) );
+         producers.clear();
+      }
+
+      int128_t vote_units()const    { return last_vote_units.has_value() ? last_vote_units.value() : to_vote_units( last_vote_weight ); }
+      int128_t proxied_units()const { return proxied_vote_units.has_value() ? proxied_vote_units.value() : to_vote_units( proxied_vote_weight ); }
+      /// rows without vote units are extended with both
+      void     set_vote_units( int128_t units ) {
+         proxied_vote_units.emplace( proxied_units() );
+         last_vote_weight = from_vote_units( units );
+         last_vote_units.emplace( units );
+      }
+      void     set_proxied_units( int128_t units ) {
+         last_vote_units.emplace( vote_units() );
+         proxied_vote_weight = from_vote_units( units );
+         proxied_vote_units.emplace( units );
+      }
+
+      /// scales the vote weights of the row down to the given, later, vote epoch
+      void     rebase_votes( uint32_t epoch ) {
+         const uint32_t years = epoch - vote_epoch;
+         set_proxied_units( rebase_vote_units( proxied_units(), years ) );
+         set_vote_units( rebase_vote_units( vote_units(), years ) );
+         vote_epoch = epoch;
+      }
+
+      /// whether nothing but the stake is recorded in this row, so it can be erased once the stake is zero;
+      /// rows of accounts that have voted are kept, their vote units mark their stake as activated
+      bool     holds_only_stake()const {
+         return !proxy && !has_producers() && !is_proxy && proxied_units() == 0 && vote_units() <= 0 && flags1 == 0;
+      }
+
       enum class flags1_fields : uint32_t {
          ram_managed = 1,
          net_managed = 2,
@@ -185,11 +399,117 @@ namespace eosiosystem {
       };
 
       // explicit serialization macro is not necessary, used here only to improve compilation time
-      EOSLIB_SERIALIZE( voter_info, (owner)(proxy)(producers)(staked)(last_vote_weight)(proxied_vote_weight)(is_proxy)(flags1)(reserved2)(reserved3) )
+      EOSLIB_SERIALIZE( voter_info, (owner)(proxy)(producers)(staked)(last_vote_weight)(proxied_vote_weight)(is_proxy)(flags1)(vote_epoch)(reserved3)
+                        (last_vote_units)(proxied_vote_units)(version)(producer_ids) )
    };
 
    typedef eosio::multi_index< "voters"_n, voter_info >  voters_table;
 
+   /**
+    *  A proxy whose proxied_vote_weight has changed since its producers were last updated.
+    *  Pending changes are applied in bulk by flushproxies and onblock.
+    */
+   struct [[eosio::table, eosio::contract("eosio.system")]] dirty_proxy {
+      name                owner;
+
+      uint64_t primary_key()const { return owner.value; }
+
+      // explicit serialization macro is not necessary, used here only to improve compilation time
+      EOSLIB_SERIALIZE( dirty_proxy, (owner) )
+   };
+
+   typedef eosio::multi_index< "dirtyproxies"_n, dirty_proxy > dirty_proxies_table;
+
+   /**
+    *  Producer vote tally rebuilt from the voters table by recalcvotes.
+    */
+   struct [[eosio::table, eosio::contract("eosio.system")]] vote_tally {
+      name                owner;
+      int128_t            total_vote_units = 0;
+
+      uint64_t primary_key()const { return owner.value; }
+
+      // explicit serialization macro is not necessary, used here only to improve compilation time
+      EOSLIB_SERIALIZE( vote_tally, (owner)(total_vote_units) )
+   };
+
+   typedef eosio::multi_index< "votetally"_n, vote_tally > vote_tally_table;
+
+   /**
+    *  Number of voters that vote for an account as a producer and of voters that use it as their proxy,
+    *  kept apart from the producers and voters rows.
+    */
+   struct [[eosio::table, eosio::contract("eosio.system")]] vote_count {
+      name                owner;
+      uint32_t            voter_count = 0;     /// voters that list owner among their producers
+      uint32_t            delegator_count = 0; /// voters that use owner as their proxy
+
+      uint64_t primary_key()const { return owner.value; }
+
+      // explicit serialization macro is not necessary, used here only to improve compilation time
+      EOSLIB_SERIALIZE( vote_count, (owner)(voter_count)(delegator_count) )
+   };
+
+   typedef eosio::multi_index< "votecounts"_n, vote_count > vote_counts_table;
+
+   /**
+    *  Delegation of a voter to a proxy, indexed by proxy and then voter so that the delegators of a proxy
+    *  can be enumerated, and paginated, without scanning the voters table.
+    */
+   struct [[eosio::table, eosio::contract("eosio.system")]] delegation {
+      name                owner; /// the voter
+      name                proxy; /// the proxy set by the voter
+
+      uint64_t  primary_key()const { return owner.value; }
+      uint128_t by_proxy()const    { return (uint128_t(proxy.value) << 64) | owner.value; }
+
+      // explicit serialization macro is not necessary, used here only to improve compilation time
+      EOSLIB_SERIALIZE( delegation, (owner)(proxy) )
+   };
+
+   typedef eosio::multi_index< "delegations"_n, delegation,
+                               indexed_by<"byproxy"_n, const_mem_fun<delegation, uint128_t, &delegation::by_proxy>  >
+                             > delegations_table;
+
+   /**
+    *  Time at which the vote weight of a voter that votes for producers or a proxy was last computed,
+    *  indexed by that time so that onblock can refresh the stalest votes first.
+    */
+   struct [[eosio::table, eosio::contract("eosio.system")]] vote_age {
+      name                owner;
+      time_point          last_vote_update;
+
+      uint64_t  primary_key()const { return owner.value; }
+      uint64_t  by_update()const   { return uint64_t( last_vote_update.time_since_epoch().count() ); }
+
+      // explicit serialization macro is not necessary, used here only to improve compilation time
+      EOSLIB_SERIALIZE( vote_age, (owner)(last_vote_update) )
+   };
+
+   typedef eosio::multi_index< "voteages"_n, vote_age,
+                               indexed_by<"byupdate"_n, const_mem_fun<vote_age, uint64_t, &vote_age::by_update>  >
+                             > vote_ages_table;
+
+   static constexpr uint64_t     vote_event_capacity = 1024;
+
+   /**
+    *  Change of the votes of a producer caused by a voter, kept in a ring of vote_event_capacity rows
+    *  that indexers can tail instead of replaying actions. A change of the vote weight of a voter is
+    *  recorded once for every producer it votes for.
+    */
+   struct [[eosio::table, eosio::contract("eosio.system")]] vote_event {
+      uint64_t            seq = 0;
+      name                voter;
+      name                producer;
+      int128_t            delta = 0; ///< in vote units
+
+      uint64_t primary_key()const { return seq % vote_event_capacity; }
+
+      // explicit serialization macro is not necessary, used here only to improve compilation time
+      EOSLIB_SERIALIZE( vote_event, (seq)(voter)(producer)(delta) )
+   };
+
+   typedef eosio::multi_index< "voteevents"_n, vote_event > vote_events_table;
 
    typedef eosio::multi_index< "producers"_n, producer_info,
                                indexed_by<"prototalvote"_n, const_mem_fun<producer_info, double, &producer_info::by_votes>  >
@@ -199,6 +519,8 @@ namespace eosiosystem {
    typedef eosio::singleton< "global"_n, eosio_global_state >   global_state_singleton;
    typedef eosio::singleton< "global2"_n, eosio_global_state2 > global_state2_singleton;
    typedef eosio::singleton< "global3"_n, eosio_global_state3 > global_state3_singleton;
+   typedef eosio::singleton< "global4"_n, eosio_global_state4 > global_state4_singleton;
+   typedef eosio::singleton< "global5"_n, eosio_global_state5 > global_state5_singleton;
 
    //   static constexpr uint32_t     max_inflation_rate = 5;  // 5% annual inflation
    static constexpr uint32_t     seconds_per_day = 24 * 3600;
@@ -211,11 +533,22 @@ namespace eosiosystem {
          global_state_singleton  _global;
          global_state2_singleton _global2;
          global_state3_singleton _global3;
+         global_state4_singleton _global4;
+         global_state5_singleton _global5;
          eosio_global_state      _gstate;
          eosio_global_state2     _gstate2;
          eosio_global_state3     _gstate3;
+         eosio_global_state4     _gstate4;
+         eosio_global_state5     _gstate5;
          rammarket               _rammarket;
 
+         /// global states as loaded, empty if not stored yet; only states that differ are written back
+         std::vector<char>       _gstate_loaded;
+         std::vector<char>       _gstate2_loaded;
+         std::vector<char>       _gstate3_loaded;
+         std::vector<char>       _gstate4_loaded;
+         std::vector<char>       _gstate5_loaded;
+
       public:
          static constexpr eosio::name active_permission{"active"_n};
          static constexpr eosio::name token_account{"eosio.token"_n};
@@ -313,6 +646,14 @@ namespace eosiosystem {
          [[eosio::action]]
          void refund( name owner );
 
+         /**
+          *  Erases up to max_rows voter rows, starting at lower_bound, that have no stake and hold
+          *  nothing else, such as rows left behind by a full unstake before they were pruned
+          *  automatically.
+          */
+         [[eosio::action]]
+         void prunevoters( const name lower_bound, uint16_t max_rows );
+
          // functions defined in voting.cpp
 
          [[eosio::action]]
@@ -326,12 +667,80 @@ namespace eosiosystem {
          [[eosio::action]]
          void setramrate( uint16_t bytes_per_block );
 
+         /**
+          *  Sets the number of stale voters whose vote weight is refreshed in every block, trading
+          *  onblock CPU against how current the vote weights are. Zero disables the refresh. Voters
+          *  are tracked for refreshing from their next vote or stake change while it is enabled.
+          */
+         [[eosio::action]]
+         void setrefresh( uint16_t voters_per_block );
+
+         /**
+          *  Sets the order of the producers in the schedules proposed from now on, one of
+          *  eosio_global_state4::schedule_orders.
+          */
+         [[eosio::action]]
+         void setschedmode( uint8_t schedule_order );
+
+         /**
+          *  Sets the maximum number of producers elected into a schedule, at most 21, and the number
+          *  of block slots between elections, from one minute to one day.
+          */
+         [[eosio::action]]
+         void setelection( uint16_t schedule_size, uint32_t update_slots );
+
          [[eosio::action]]
          void voteproducer( const name voter, const name proxy, const std::vector<name>& producers );
 
          [[eosio::action]]
          void regproxy( const name proxy, bool isproxy );
 
+         /**
+          *  Applies pending proxied weight changes of at most max_proxies proxies to the
+          *  producers they vote for. Anyone may call this action.
+          */
+         [[eosio::action]]
+         void flushproxies( uint16_t max_proxies );
+
+         /**
+          *  Moves the votepay state of at most max_producers producers from the legacy producers2
+          *  table into their producers rows. Anyone may call this action.
+          */
+         [[eosio::action]]
+         void migrateprods( uint16_t max_producers );
+
+         /**
+          *  Counts the votes of at most max_voters existing voters in votecounts and records their delegations.
+          *  These are complete once every voter has been visited. Anyone may call this action.
+          */
+         [[eosio::action]]
+         void buildcounts( uint16_t max_voters );
+
+         /**
+          *  Recomputes the vote weight of at most limit voters that delegate to proxy, starting at the
+          *  delegator cursor, and queues the resulting change of the weight of the proxy.
+          */
+         [[eosio::action]]
+         void refreshproxy( const name proxy, const name cursor, uint16_t limit );
+
+         /**
+          *  Recomputes the vote weight of each of the given voters from their current stake, as if they had
+          *  voted again for the same producers or proxy. The changes of all voters are summed so that every
+          *  producer voted for is updated once. Requires the authority of every voter.
+          */
+         [[eosio::action]]
+         void refreshvotes( const std::vector<name>& voters );
+
+         /**
+          *  Recomputes the producer vote tallies from the voters table, repairing the drift that
+          *  accumulates from applying floating point deltas. The rebuild is resumable: every call
+          *  processes at most limit voters, or later producers, starting at cursor, which must match
+          *  the recalc_cursor stored in global4. A new rebuild is started by calling with an empty
+          *  cursor while none is in progress.
+          */
+         [[eosio::action]]
+         void recalcvotes( const name cursor, uint32_t limit );
+
          [[eosio::action]]
          void setparams( const eosio::blockchain_parameters& params );
 
@@ -345,6 +754,14 @@ namespace eosiosystem {
          [[eosio::action]]
          void rmvproducer( name producer );
 
+         /**
+          *  Erases up to max_rows producers, starting at lower_bound, that are inactive, have no votes
+          *  and no unpaid blocks, and have not claimed rewards for at least min_idle_days days.
+          *  Any votepay share they still hold is removed from the global total.
+          */
+         [[eosio::action]]
+         void gcproducers( const name lower_bound, uint16_t max_rows, uint32_t min_idle_days );
+
          [[eosio::action]]
          void updtrevision( uint8_t revision );
 
@@ -378,12 +795,34 @@ namespace eosiosystem {
 
          //defined in voting.hpp
          void update_elected_producers( block_timestamp timestamp );
-         void update_votes( const name voter, const name proxy, const std::vector<name>& producers, bool voting );
+         void update_votes( const name voter, const name proxy, const std::vector<name>& producers );
 
          // defined in voting.cpp
+         void update_voter_stake( const voter_info& voter, int64_t stake_delta );
          void propagate_weight_change( const voter_info& voter );
-
-         double update_producer_votepay_share( const producers_table2::const_iterator& prod_itr,
+         void adjust_proxied_weight( const name proxy, int128_t delta );
+         void queue_weight_change( const voter_info& proxy );
+         uint32_t flush_dirty_proxies( uint32_t max_proxies );
+         void flush_round_blocks();
+         void load_top_bid();
+         uint32_t refresh_stale_votes( uint32_t max_voters );
+         void record_vote_ages( uint32_t max_voters );
+         void update_vote_age( const name voter, bool has_votes, const name payer );
+         void record_vote_event( const name voter, const name producer, int128_t delta );
+
+         void update_producer_votes( const producer_info& prod, int128_t delta, time_point ct,
+                                     double& delta_change_rate, double& total_inactive_vpay_share );
+         void record_vote_delta( const name voter, const name producer, int128_t delta );
+         void record_tally_delta( const name producer, int128_t delta );
+         void migrate_producer( const producer_info& prod );
+         void rebase_voter( const voter_info& voter );
+         void roll_vote_epoch();
+         void rebase_producers( uint32_t max_producers );
+         void update_vote_count( const name owner, int32_t voters_delta, int32_t delegators_delta );
+         void update_delegation( const name voter, const name proxy, const name payer );
+         std::vector<name> voter_producers( const voter_info& voter );
+         uint32_t producer_id_of( const producer_info& prod, const name payer );
+         double update_producer_votepay_share( producer_info& prod,
                                                time_point ct,
                                                double shares_rate, bool reset_to_zero = false );
          double update_total_votepay_share( time_point ct,
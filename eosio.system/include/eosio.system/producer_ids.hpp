@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace eosiosystem {
+
+   /**
+    *  Encodes ascending producer ids as the differences between consecutive ids, the first one relative
+    *  to zero, each as a little-endian base-128 varint. Ids are dense, so a list of 30 producers usually
+    *  takes one or two bytes per producer instead of the 8 bytes of its name.
+    */
+   inline std::vector<char> encode_producer_ids( const std::vector<uint32_t>& ids ) {
+      std::vector<char> data;
+      data.reserve( 2 * ids.size() );
+      uint32_t last = 0;
+      for( const auto id : ids ) {
+         uint32_t delta = id - last;
+         last = id;
+         do {
+            uint8_t b = delta & 0x7f;
+            delta >>= 7;
+            if( delta )
+               b |= 0x80;
+            data.push_back( char(b) );
+         } while( delta );
+      }
+      return data;
+   }
+
+   inline std::vector<uint32_t> decode_producer_ids( const std::vector<char>& data ) {
+      std::vector<uint32_t> ids;
+      ids.reserve( data.size() );
+      uint32_t last = 0;
+      for( size_t i = 0; i < data.size(); ) {
+         uint32_t delta = 0;
+         uint8_t  b     = 0;
+         for( int shift = 0; i < data.size() && shift < 35; shift += 7 ) {
+            b = uint8_t( data[i++] );
+            delta |= uint32_t( b & 0x7f ) << shift;
+            if( !( b & 0x80 ) )
+               break;
+         }
+         last += delta;
+         ids.push_back( last );
+      }
+      return ids;
+   }
+
+} /// namespace eosiosystem
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+namespace eosiosystem {
+
+   /**
+    *  Vote weight multiplier for every whole week since the start of the vote epoch, i.e.
+    *  `pow(2, weeks / 52.0)` precomputed for one epoch and a margin of 12 weeks for a roll that
+    *  is held back, so that stake2vote does not have to evaluate pow in softfloat on every vote
+    *  update. Weeks outside the table, such as before the first epoch roll, fall back to pow.
+    */
+   constexpr int64_t vote_weight_table_weeks = 64;
+
+   constexpr double vote_weight_table[vote_weight_table_weeks] = {
+      1.0, 1.0134189906987003, 1.0270180507087725, 1.0407995963786307,
+      1.0547660764816467, 1.0689199726512586, 1.0832637998219208, 1.09780010667597,
+      1.1125314760964868, 1.127460525626237, 1.1425899079327673, 1.1579223112797459,
+      1.1734604600046263, 1.189207115002721, 1.2051650742177709, 1.2213371731390976,
+      1.237726285305428, 1.2543353228154785, 1.2711672368453906, 1.2882250181731114,
+      1.3055116977098096, 1.323030347038422, 1.3407840789594287, 1.3587760480439508,
+      1.3770094511942694, 1.3954875282118677, 1.4142135623730951, 1.4331908810125555,
+      1.452422856114325, 1.4719129049111028, 1.4916644904914018, 1.5116811224148876,
+      1.5319663573359739, 1.552523799635787, 1.5733571020626107, 1.594469966380923,
+      1.6158661440291455, 1.6375494367862173, 1.6595236974471135, 1.681792830507429,
+      1.7043607928571491, 1.7272315944837286, 1.7504092991846072, 1.773898025289284,
+      1.7977019463910837, 1.8218252920887412, 1.8462723487379369, 1.871047460212919,
+      1.896155028678343, 1.9215995153714713, 1.9473854413948684, 1.9735173885197304,
+      2.0, 2.0268379813974007, 2.054036101417545, 2.0815991927572615,
+      2.1095321529632933, 2.137839945302517, 2.1665275996438416, 2.19560021335194,
+      2.2250629521929737, 2.254921051252474, 2.2851798158655345, 2.3158446225594918
+   };
+
+   inline double vote_weight_multiplier( int64_t weeks ) {
+      if( 0 <= weeks && weeks < vote_weight_table_weeks )
+         return vote_weight_table[weeks];
+      return std::pow( 2, weeks / double( 52 ) );
+   }
+
+   /// producer tallies are kept in units of 2^-vote_unit_bits of a vote weight
+   constexpr int vote_unit_bits = 32;
+
+   /**
+    *  Converts a vote weight to the whole units in which vote weights and producer tallies are kept, rounding
+    *  half away from zero. Within a vote epoch tallies of whole units add up exactly, whatever order votes are
+    *  applied in.
+    */
+   inline __int128 to_vote_units( double weight ) {
+      const double scaled = std::ldexp( weight, vote_unit_bits );
+      return static_cast<__int128>( scaled < 0 ? scaled - 0.5 : scaled + 0.5 );
+   }
+
+   inline double from_vote_units( __int128 units ) {
+      return std::ldexp( static_cast<double>( units ), -vote_unit_bits );
+   }
+
+   /**
+    *  Rebases vote units by the given number of vote epochs, i.e. halves them once per year that the epoch
+    *  advanced, rounding down. A tally and the votes it sums are rebased separately; rounding each down keeps
+    *  the rebased tally at least the sum of the rebased votes, and above it by less than one unit per vote.
+    */
+   inline __int128 rebase_vote_units( __int128 units, uint32_t years ) {
+      if( years > 127 )
+         return units < 0 ? -1 : 0;
+      return units >> years;
+   }
+
+} /// namespace eosiosystem
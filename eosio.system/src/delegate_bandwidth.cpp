@@ -414,24 +414,29 @@ namespace eosiosystem {
       {
          asset total_update = stake_net_delta + stake_cpu_delta;
          auto from_voter = _voters.find( from.value );
+         const int64_t staked = ( from_voter == _voters.end() ? 0 : from_voter->staked ) + total_update.amount;
+         eosio_assert( 0 <= staked, "stake for voting cannot be negative");
+         if( from == "b1"_n ) {
+            validate_b1_vesting( staked );
+         }
+
          if( from_voter == _voters.end() ) {
-            from_voter = _voters.emplace( from, [&]( auto& v ) {
-                  v.owner  = from;
-                  v.staked = total_update.amount;
+            _voters.emplace( from, [&]( auto& v ) {
+                  v.owner      = from;
+                  v.staked     = staked;
+                  v.vote_epoch = _gstate4.vote_epoch;
                });
+         } else if( from_voter->has_producers() || from_voter->proxy ) {
+            /// only the stake changes, so the weight difference is applied and stored with the new stake in one write
+            update_voter_stake( *from_voter, total_update.amount );
+         } else if( staked == 0 && from_voter->holds_only_stake() ) {
+            /// nothing is left in the row once the stake is gone
+            _voters.erase( from_voter );
          } else {
             _voters.modify( from_voter, same_payer, [&]( auto& v ) {
-                  v.staked += total_update.amount;
+                  v.staked = staked;
                });
          }
-         eosio_assert( 0 <= from_voter->staked, "stake for voting cannot be negative");
-         if( from == "b1"_n ) {
-            validate_b1_vesting( from_voter->staked );
-         }
-
-         if( from_voter->producers.size() || from_voter->proxy ) {
-            update_votes( from, from_voter->proxy, from_voter->producers, false );
-         }
       }
    }
 
@@ -479,5 +484,19 @@ namespace eosiosystem {
       refunds_tbl.erase( req );
    }
 
+   void system_contract::prunevoters( const name lower_bound, uint16_t max_rows ) {
+      require_auth( _self );
+      eosio_assert( max_rows > 0, "max_rows must be positive" );
+
+      auto voter = _voters.lower_bound( lower_bound.value );
+      for( uint16_t i = 0; i < max_rows && voter != _voters.end(); ++i ) {
+         if( voter->staked == 0 && voter->holds_only_stake() ) {
+            voter = _voters.erase( voter );
+         } else {
+            ++voter;
+         }
+      }
+   }
+
 
 } //namespace eosiosystem
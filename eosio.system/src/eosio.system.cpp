@@ -18,13 +18,43 @@ namespace eosiosystem {
     _global(_self, _self.value),
     _global2(_self, _self.value),
     _global3(_self, _self.value),
+    _global4(_self, _self.value),
+    _global5(_self, _self.value),
     _rammarket(_self, _self.value)
    {
 
       //print( "construct system\n" );
-      _gstate  = _global.exists() ? _global.get() : get_default_parameters();
-      _gstate2 = _global2.exists() ? _global2.get() : eosio_global_state2{};
-      _gstate3 = _global3.exists() ? _global3.get() : eosio_global_state3{};
+      if( _global.exists() ) {
+         _gstate        = _global.get();
+         _gstate_loaded = eosio::pack( _gstate );
+      } else {
+         _gstate = get_default_parameters();
+      }
+      if( _global2.exists() ) {
+         _gstate2        = _global2.get();
+         _gstate2_loaded = eosio::pack( _gstate2 );
+      }
+      if( _global3.exists() ) {
+         _gstate3        = _global3.get();
+         _gstate3_loaded = eosio::pack( _gstate3 );
+      }
+      if( _global4.exists() ) {
+         _gstate4        = _global4.get();
+         _gstate4_loaded = eosio::pack( _gstate4 );
+      } else {
+         _gstate4 = eosio_global_state4{};
+         _gstate4.total_producer_vote_units = to_vote_units( _gstate.total_producer_vote_weight );
+         _gstate4.counts_built = ( _voters.begin() == _voters.end() );
+         load_top_bid();
+      }
+      if( _global5.exists() ) {
+         _gstate5        = _global5.get();
+         _gstate5_loaded = eosio::pack( _gstate5 );
+      } else {
+         _gstate5.last_producer_schedule_update = _gstate.last_producer_schedule_update;
+         _gstate5.total_unpaid_blocks           = _gstate.total_unpaid_blocks;
+         _gstate5.last_block_num                = _gstate2.last_block_num;
+      }
    }
 
    eosio_global_state system_contract::get_default_parameters() {
@@ -49,9 +79,26 @@ namespace eosiosystem {
    }
 
    system_contract::~system_contract() {
-      _global.set( _gstate, _self );
-      _global2.set( _gstate2, _self );
-      _global3.set( _gstate3, _self );
+      /// most actions do not change the global states, so they are only written if they differ from what was loaded
+      /// the copies of the per block counters and of the vote total in global and global2 are refreshed at every election
+      /// or when written anyway
+      const bool elected = ( _gstate.last_producer_schedule_update.slot != _gstate5.last_producer_schedule_update.slot );
+      if( elected || eosio::pack( _gstate ) != _gstate_loaded ) {
+         _gstate.last_producer_schedule_update = _gstate5.last_producer_schedule_update;
+         _gstate.total_unpaid_blocks           = _gstate5.total_unpaid_blocks;
+         _gstate.total_producer_vote_weight    = from_vote_units( _gstate4.total_producer_vote_units );
+         _global.set( _gstate, _self );
+      }
+      if( elected || eosio::pack( _gstate2 ) != _gstate2_loaded ) {
+         _gstate2.last_block_num = _gstate5.last_block_num;
+         _global2.set( _gstate2, _self );
+      }
+      if( eosio::pack( _gstate3 ) != _gstate3_loaded )
+         _global3.set( _gstate3, _self );
+      if( eosio::pack( _gstate4 ) != _gstate4_loaded )
+         _global4.set( _gstate4, _self );
+      if( eosio::pack( _gstate5 ) != _gstate5_loaded )
+         _global5.set( _gstate5, _self );
    }
 
    void system_contract::setram( uint64_t max_ram_size ) {
@@ -106,6 +153,34 @@ namespace eosiosystem {
       _gstate2.new_ram_per_block = bytes_per_block;
    }
 
+   void system_contract::setrefresh( uint16_t voters_per_block ) {
+      require_auth( _self );
+      eosio_assert( voters_per_block <= max_vote_refreshes, "at most 20 voters can be refreshed per block" );
+      /// votes cast while refreshing was disabled have no vote age, onblock records them once it is enabled
+      if( voters_per_block == 0 ) {
+         _gstate4.aging = false;
+      } else if( _gstate4.vote_refreshes_per_block == 0 ) {
+         _gstate4.aging = true;
+      }
+      _gstate4.age_cursor = name();
+      _gstate4.vote_refreshes_per_block = voters_per_block;
+   }
+
+   void system_contract::setschedmode( uint8_t schedule_order ) {
+      require_auth( _self );
+      eosio_assert( schedule_order <= uint8_t(eosio_global_state4::schedule_orders::by_location), "unknown schedule order" );
+      _gstate4.schedule_order = schedule_order;
+   }
+
+   void system_contract::setelection( uint16_t schedule_size, uint32_t update_slots ) {
+      require_auth( _self );
+      eosio_assert( 0 < schedule_size && schedule_size <= max_schedule_size, "schedule size must be between 1 and 21" );
+      eosio_assert( min_schedule_interval <= update_slots && update_slots <= blocks_per_day,
+                    "elections must be between one minute and one day apart" );
+      _gstate4.schedule_size         = schedule_size;
+      _gstate4.schedule_update_slots = update_slots;
+   }
+
    void system_contract::setparams( const eosio::blockchain_parameters& params ) {
       require_auth( _self );
       (eosio::blockchain_parameters&)(_gstate) = params;
@@ -278,6 +353,39 @@ namespace eosiosystem {
          });
    }
 
+   void system_contract::gcproducers( const name lower_bound, uint16_t max_rows, uint32_t min_idle_days ) {
+      require_auth( _self );
+      eosio_assert( max_rows > 0, "max_rows must be positive" );
+
+      const auto ct       = current_time_point();
+      const auto min_idle = microseconds( int64_t(min_idle_days) * useconds_per_day );
+      double removed_votepay_share = 0;
+      flush_round_blocks(); // so that producers with blocks of the current round are not idle
+
+      auto prod = _producers.lower_bound( lower_bound.value );
+      for( uint16_t i = 0; i < max_rows && prod != _producers.end(); ++i ) {
+         if( prod->active() || prod->total_votes != 0 || prod->unpaid_blocks != 0 || ct - prod->last_claim_time < min_idle ) {
+            ++prod;
+            continue;
+         }
+
+         /// the shares are rebased to the current vote epoch like the total they are removed from
+         if( prod->has_votepay_share() ) {
+            removed_votepay_share += std::ldexp( prod->votepay_share.value(), -int(_gstate4.vote_epoch - prod->votes_epoch()) );
+         }
+         auto prod2 = _producers2.find( prod->owner.value );
+         if( prod2 != _producers2.end() ) {
+            removed_votepay_share += std::ldexp( prod2->votepay_share, -int(_gstate4.vote_epoch) );
+            _producers2.erase( prod2 );
+         }
+         prod = _producers.erase( prod );
+      }
+
+      if( removed_votepay_share > 0 ) {
+         update_total_votepay_share( ct, -removed_votepay_share );
+      }
+   }
+
    void system_contract::updtrevision( uint8_t revision ) {
       require_auth( _self );
       eosio_assert( _gstate2.revision < 255, "can not increment revision" ); // prevent wrap around
@@ -348,6 +456,33 @@ namespace eosiosystem {
             b.last_bid_time = current_time_point();
          });
       }
+
+      /// open bids only increase, so a new highest bid is the only change of the highest bid here
+      /// ties go to the lower name, as in the highbid index
+      if( newname == _gstate4.top_bid_name || bid.amount > _gstate4.top_bid ||
+          ( bid.amount == _gstate4.top_bid && newname < _gstate4.top_bid_name ) ) {
+         _gstate4.top_bid_name = newname;
+         _gstate4.top_bid      = bid.amount;
+         _gstate4.top_bid_time = current_time_point();
+      }
+   }
+
+   /**
+    *  Caches the highest open bid from the highbid index.
+    */
+   void system_contract::load_top_bid() {
+      name_bid_table bids(_self, _self.value);
+      auto idx = bids.get_index<"highbid"_n>();
+      auto highest = idx.lower_bound( std::numeric_limits<uint64_t>::max()/2 );
+      if( highest != idx.end() && highest->high_bid > 0 ) {
+         _gstate4.top_bid_name = highest->newname;
+         _gstate4.top_bid      = highest->high_bid;
+         _gstate4.top_bid_time = highest->last_bid_time;
+      } else {
+         _gstate4.top_bid_name = name();
+         _gstate4.top_bid      = 0;
+         _gstate4.top_bid_time = time_point();
+      }
    }
 
    void system_contract::bidrefund( name bidder, name newname ) {
@@ -447,16 +582,35 @@ namespace eosiosystem {
 } /// eosio.system
 
 
-EOSIO_DISPATCH( eosiosystem::system_contract,
-     // native.hpp (newaccount definition is actually in eosio.system.cpp)
-     (newaccount)(updateauth)(deleteauth)(linkauth)(unlinkauth)(canceldelay)(onerror)(setabi)
-     // eosio.system.cpp
-     (init)(setram)(setramrate)(setparams)(setpriv)(setalimits)(setacctram)(setacctnet)(setacctcpu)
-     (rmvproducer)(updtrevision)(bidname)(bidrefund)
-     // delegate_bandwidth.cpp
-     (buyrambytes)(buyram)(sellram)(delegatebw)(undelegatebw)(refund)
-     // voting.cpp
-     (regproducer)(unregprod)(voteproducer)(regproxy)
-     // producer_pay.cpp
-     (onblock)(claimrewards)
-)
+extern "C" {
+   void apply( uint64_t receiver, uint64_t code, uint64_t action ) {
+      if( code != receiver )
+         return;
+
+      switch( action ) {
+         /// native actions with nothing for the contract to do return before any contract state is loaded
+         case "updateauth"_n.value:
+         case "deleteauth"_n.value:
+         case "linkauth"_n.value:
+         case "unlinkauth"_n.value:
+         case "canceldelay"_n.value:
+         case "onerror"_n.value:
+         case "setcode"_n.value:
+            return;
+
+         EOSIO_DISPATCH_HELPER( eosiosystem::system_contract,
+              // native.hpp (newaccount definition is actually in eosio.system.cpp)
+              (newaccount)(setabi)
+              // eosio.system.cpp
+              (init)(setram)(setramrate)(setrefresh)(setschedmode)(setelection)(setparams)(setpriv)(setalimits)(setacctram)(setacctnet)(setacctcpu)
+              (rmvproducer)(gcproducers)(updtrevision)(bidname)(bidrefund)
+              // delegate_bandwidth.cpp
+              (buyrambytes)(buyram)(sellram)(delegatebw)(undelegatebw)(refund)(prunevoters)
+              // voting.cpp
+              (regproducer)(unregprod)(voteproducer)(regproxy)(flushproxies)(migrateprods)(buildcounts)(refreshproxy)(refreshvotes)(recalcvotes)
+              // producer_pay.cpp
+              (onblock)(claimrewards)
+         )
+      }
+   }
+}
@@ -2,6 +2,8 @@
 
 #include <eosio.token/eosio.token.hpp>
 
+#include <algorithm>
+
 namespace eosiosystem {
 
    const int64_t  min_pervote_daily_pay = 100'0000;
@@ -15,6 +17,12 @@ namespace eosiosystem {
    const uint32_t blocks_per_hour       = 2 * 3600;
    const int64_t  useconds_per_day      = 24 * 3600 * int64_t(1000000);
    const int64_t  useconds_per_year     = seconds_per_year*1000000ll;
+   const uint32_t proxies_per_block     = 2;                // queued proxy weight changes applied per block
+   const uint32_t rebases_per_block     = 10;               // producers visited to rebase them to a new vote epoch per block
+   const uint16_t max_vote_refreshes    = 20;               // stale voters refreshed per block at most
+   const uint32_t vote_ages_per_block   = 20;               // voters visited to record their vote ages per block
+   const uint16_t max_schedule_size     = 21;               // producers elected into a schedule
+   const uint32_t min_schedule_interval = 2 * 60;           // block slots between elections, one minute
 
    void system_contract::onblock( ignore<block_header> ) {
       using namespace eosio;
@@ -25,10 +33,21 @@ namespace eosiosystem {
       name producer;
       _ds >> timestamp >> producer;
 
-      // _gstate2.last_block_num is not used anywhere in the system contract code anymore.
+      // _gstate5.last_block_num is not used anywhere in the system contract code anymore.
       // Although this field is deprecated, we will continue updating it for now until the last_block_num field
       // is eventually completely removed, at which point this line can be removed.
-      _gstate2.last_block_num = timestamp;
+      _gstate5.last_block_num = timestamp;
+
+      /// start a new vote epoch once a year and rebase a bounded number of producers to it in every block
+      roll_vote_epoch();
+      rebase_producers( rebases_per_block );
+
+      /// apply a bounded number of queued proxy weight changes in every block
+      flush_dirty_proxies( proxies_per_block );
+
+      /// refresh the vote weight of the stalest voters, after recording the vote ages of the voters that have none
+      record_vote_ages( vote_ages_per_block );
+      refresh_stale_votes( _gstate4.vote_refreshes_per_block );
 
       /** until activated stake crosses this threshold no new rewards are paid */
       if( _gstate.total_activated_stake < min_activated_stake )
@@ -41,38 +60,65 @@ namespace eosiosystem {
       /**
        * At startup the initial producer may not be one that is registered / elected
        * and therefore there may be no producer object for them.
+       *
+       * The blocks of a producer already seen in this round are only counted in global5.
        */
-      auto prod = _producers.find( producer.value );
-      if ( prod != _producers.end() ) {
-         _gstate.total_unpaid_blocks++;
-         _producers.modify( prod, same_payer, [&](auto& p ) {
-               p.unpaid_blocks++;
-         });
+      auto& round = _gstate5.round_blocks;
+      auto counted = std::find_if( round.begin(), round.end(), [&]( const auto& r ) { return r.producer == producer; } );
+      if( counted != round.end() ) {
+         _gstate5.total_unpaid_blocks++;
+         counted->unpaid_blocks++;
+      } else if( _producers.find( producer.value ) != _producers.end() ) {
+         if( round.size() >= max_schedule_size ) {
+            flush_round_blocks();
+         }
+         _gstate5.total_unpaid_blocks++;
+         round.push_back( round_unpaid_blocks{ producer, 1 } );
       }
 
-      /// only update block producers once every minute, block_timestamp is in half seconds
-      if( timestamp.slot - _gstate.last_producer_schedule_update.slot > 120 ) {
+      /// only update block producers once every schedule_update_slots (a minute by default), block_timestamp is in half seconds
+      if( timestamp.slot - _gstate5.last_producer_schedule_update.slot > _gstate4.schedule_update_slots ) {
          update_elected_producers( timestamp );
 
-         if( (timestamp.slot - _gstate.last_name_close.slot) > blocks_per_day ) {
+         /// the highest open bid is cached in global4, the bids are only read when it closes
+         if( (timestamp.slot - _gstate.last_name_close.slot) > blocks_per_day &&
+             _gstate4.top_bid > 0 &&
+             (current_time_point() - _gstate4.top_bid_time) > microseconds(useconds_per_day) &&
+             _gstate.thresh_activated_stake_time > time_point() &&
+             (current_time_point() - _gstate.thresh_activated_stake_time) > microseconds(14 * useconds_per_day)
+         ) {
             name_bid_table bids(_self, _self.value);
-            auto idx = bids.get_index<"highbid"_n>();
-            auto highest = idx.lower_bound( std::numeric_limits<uint64_t>::max()/2 );
-            if( highest != idx.end() &&
-                highest->high_bid > 0 &&
-                (current_time_point() - highest->last_bid_time) > microseconds(useconds_per_day) &&
-                _gstate.thresh_activated_stake_time > time_point() &&
-                (current_time_point() - _gstate.thresh_activated_stake_time) > microseconds(14 * useconds_per_day)
-            ) {
+            auto highest = bids.find( _gstate4.top_bid_name.value );
+            if( highest != bids.end() && highest->high_bid > 0 ) {
                _gstate.last_name_close = timestamp;
-               idx.modify( highest, same_payer, [&]( auto& b ){
+               bids.modify( highest, same_payer, [&]( auto& b ){
                   b.high_bid = -b.high_bid;
                });
             }
+            load_top_bid();
          }
       }
    }
 
+   /**
+    *  Adds the unpaid blocks counted in the current round to the producers rows and starts a new round.
+    */
+   void system_contract::flush_round_blocks() {
+      for( const auto& r : _gstate5.round_blocks ) {
+         if( r.unpaid_blocks == 0 )
+            continue;
+         auto prod = _producers.find( r.producer.value );
+         if( prod != _producers.end() ) {
+            _producers.modify( prod, eosio::same_payer, [&]( auto& p ) {
+                  p.unpaid_blocks += r.unpaid_blocks;
+               });
+         } else {
+            _gstate5.total_unpaid_blocks -= r.unpaid_blocks;
+         }
+      }
+      _gstate5.round_blocks.clear();
+   }
+
    using namespace eosio;
    void system_contract::claimrewards( const name owner ) {
       require_auth( owner );
@@ -123,38 +169,51 @@ namespace eosiosystem {
          _gstate.last_pervote_bucket_fill = ct;
       }
 
-      auto prod2 = _producers2.find( owner.value );
+      migrate_producer( prod );
 
       /// New metric to be used in pervote pay calculation. Instead of vote weight ratio, we combine vote weight and
       /// time duration the vote weight has been held into one metric.
       const auto last_claim_plus_3days = prod.last_claim_time + microseconds(3 * useconds_per_day);
 
       bool crossed_threshold       = (last_claim_plus_3days <= ct);
+      const bool has_votepay_share = prod.has_votepay_share();
       bool updated_after_threshold = true;
-      if ( prod2 != _producers2.end() ) {
-         updated_after_threshold = (last_claim_plus_3days <= prod2->last_votepay_share_update);
-      } else {
-         prod2 = _producers2.emplace( owner, [&]( producer_info2& info  ) {
-            info.owner                     = owner;
-            info.last_votepay_share_update = ct;
-         });
+      if ( has_votepay_share ) {
+         updated_after_threshold = (last_claim_plus_3days <= prod.last_votepay_share_update.value());
       }
 
-      // Note: updated_after_threshold implies cross_threshold (except if claiming rewards when the producers2 table row did not exist).
+      // Note: updated_after_threshold implies cross_threshold (except if claiming rewards when the producer had no votepay state yet).
       // The exception leads to updated_after_threshold to be treated as true regardless of whether the threshold was crossed.
       // This is okay because in this case the producer will not get paid anything either way.
       // In fact it is desired behavior because the producers votes need to be counted in the global total_producer_votepay_share for the first time.
 
+      /// the blocks of the current round are not in the producers row yet
+      uint32_t unpaid_blocks = prod.unpaid_blocks;
+      auto& round = _gstate5.round_blocks;
+      auto counted = std::find_if( round.begin(), round.end(), [&]( const auto& r ) { return r.producer == owner; } );
+      if( counted != round.end() ) {
+         unpaid_blocks += counted->unpaid_blocks;
+         counted->unpaid_blocks = 0;
+      }
+
       int64_t producer_per_block_pay = 0;
-      if( _gstate.total_unpaid_blocks > 0 ) {
-         producer_per_block_pay = (_gstate.perblock_bucket * prod.unpaid_blocks) / _gstate.total_unpaid_blocks;
+      if( _gstate5.total_unpaid_blocks > 0 ) {
+         producer_per_block_pay = (_gstate.perblock_bucket * unpaid_blocks) / _gstate5.total_unpaid_blocks;
       }
 
-      double new_votepay_share = update_producer_votepay_share( prod2,
-                                    ct,
-                                    updated_after_threshold ? 0.0 : prod.total_votes,
-                                    true // reset votepay_share to zero after updating
-                                 );
+      const double   total_votes       = prod.total_votes;
+      double         new_votepay_share = 0.0;
+      _producers.modify( prod, same_payer, [&](auto& p) {
+         if( !has_votepay_share )
+            p.set_votepay_share( 0.0, ct );
+         new_votepay_share = update_producer_votepay_share( p,
+                                ct,
+                                updated_after_threshold ? 0.0 : total_votes,
+                                true // reset votepay_share to zero after updating
+                             );
+         p.last_claim_time = ct;
+         p.unpaid_blocks   = 0;
+      });
 
       int64_t producer_per_vote_pay = 0;
       if( _gstate2.revision > 0 ) {
@@ -165,8 +224,9 @@ namespace eosiosystem {
                producer_per_vote_pay = _gstate.pervote_bucket;
          }
       } else {
-         if( _gstate.total_producer_vote_weight > 0 ) {
-            producer_per_vote_pay = int64_t((_gstate.pervote_bucket * prod.total_votes) / _gstate.total_producer_vote_weight);
+         const double total_producer_vote_weight = from_vote_units( _gstate4.total_producer_vote_units );
+         if( total_producer_vote_weight > 0 ) {
+            producer_per_vote_pay = int64_t((_gstate.pervote_bucket * total_votes) / total_producer_vote_weight);
          }
       }
 
@@ -176,14 +236,9 @@ namespace eosiosystem {
 
       _gstate.pervote_bucket      -= producer_per_vote_pay;
       _gstate.perblock_bucket     -= producer_per_block_pay;
-      _gstate.total_unpaid_blocks -= prod.unpaid_blocks;
+      _gstate5.total_unpaid_blocks -= unpaid_blocks;
 
-      update_total_votepay_share( ct, -new_votepay_share, (updated_after_threshold ? prod.total_votes : 0.0) );
-
-      _producers.modify( prod, same_payer, [&](auto& p) {
-         p.last_claim_time = ct;
-         p.unpaid_blocks   = 0;
-      });
+      update_total_votepay_share( ct, -new_votepay_share, (updated_after_threshold ? total_votes : 0.0) );
 
       if( producer_per_block_pay > 0 ) {
          INLINE_ACTION_SENDER(eosio::token, transfer)(
@@ -3,8 +3,10 @@
  *  @copyright defined in eos/LICENSE.txt
  */
 #include <eosio.system/eosio.system.hpp>
+#include <eosio.system/vote_weight.hpp>
 
 #include <eosiolib/eosio.hpp>
+#include <eosiolib/chain.h>
 #include <eosiolib/crypto.h>
 #include <eosiolib/print.hpp>
 #include <eosiolib/datastream.hpp>
@@ -16,7 +18,11 @@
 #include <eosio.token/eosio.token.hpp>
 
 #include <algorithm>
+#include <array>
 #include <cmath>
+#include <iterator>
+#include <map>
+#include <tuple>
 
 namespace eosiosystem {
    using eosio::indexed_by;
@@ -42,6 +48,8 @@ namespace eosiosystem {
       const auto ct = current_time_point();
 
       if ( prod != _producers.end() ) {
+         migrate_producer( *prod );
+         const bool new_votepay_share = !prod->has_votepay_share();
          _producers.modify( prod, producer, [&]( producer_info& info ){
             info.producer_key = producer_key;
             info.is_active    = true;
@@ -49,19 +57,17 @@ namespace eosiosystem {
             info.location     = location;
             if ( info.last_claim_time == time_point() )
                info.last_claim_time = ct;
+            if ( new_votepay_share )
+               info.set_votepay_share( 0.0, ct );
          });
 
-         auto prod2 = _producers2.find( producer.value );
-         if ( prod2 == _producers2.end() ) {
-            _producers2.emplace( producer, [&]( producer_info2& info ){
-               info.owner                     = producer;
-               info.last_votepay_share_update = ct;
-            });
+         if ( new_votepay_share ) {
             update_total_votepay_share( ct, 0.0, prod->total_votes );
-            // When introducing the producer2 table row for the first time, the producer's votes must also be accounted for in the global total_producer_votepay_share at the same time.
+            // When introducing the votepay state for the first time, the producer's votes must also be accounted for in the global total_producer_votepay_share at the same time.
          }
+         producer_id_of( *prod, producer );
       } else {
-         _producers.emplace( producer, [&]( producer_info& info ){
+         auto itr = _producers.emplace( producer, [&]( producer_info& info ){
             info.owner           = producer;
             info.total_votes     = 0;
             info.producer_key    = producer_key;
@@ -69,11 +75,10 @@ namespace eosiosystem {
             info.url             = url;
             info.location        = location;
             info.last_claim_time = ct;
+            info.set_votepay_share( 0.0, ct );
+            info.rebase_votes( _gstate4.vote_epoch ); // starts out without votes in the current vote epoch
          });
-         _producers2.emplace( producer, [&]( producer_info2& info ){
-            info.owner                     = producer;
-            info.last_votepay_share_update = ct;
-         });
+         producer_id_of( *itr, producer );
       }
 
    }
@@ -87,24 +92,69 @@ namespace eosiosystem {
       });
    }
 
+   /**
+    *  Computes a fingerprint of an ordered producer schedule by chaining sha256 over each
+    *  (owner, key) pair, so that no packed copy of the whole schedule has to be built.
+    */
+   capi_checksum256 producer_schedule_hash( const std::vector< std::pair<eosio::producer_key,uint16_t> >& top_producers ) {
+      capi_checksum256 hash{};
+      char buffer[128];
+      for( const auto& item : top_producers ) {
+         datastream<char*> ds( buffer, sizeof(buffer) );
+         ds << hash << item.first.producer_name << item.first.block_signing_key;
+         sha256( buffer, ds.tellp(), &hash );
+      }
+      return hash;
+   }
+
+   /**
+    *  Whether the producers of an ordered schedule are, in the same order, those of the active schedule.
+    */
+   bool is_active_schedule( const std::vector< std::pair<eosio::producer_key,uint16_t> >& top_producers ) {
+      const uint32_t size = get_active_producers( nullptr, 0 );
+      std::vector<capi_name> active( size / sizeof(capi_name) );
+      get_active_producers( active.data(), size );
+      return std::equal( top_producers.begin(), top_producers.end(), active.begin(), active.end(),
+                         []( const auto& item, capi_name owner ) { return item.first.producer_name.value == owner; } );
+   }
+
    void system_contract::update_elected_producers( block_timestamp block_time ) {
-      _gstate.last_producer_schedule_update = block_time;
+      _gstate5.last_producer_schedule_update = block_time;
+
+      /// candidates are not comparable until all of them are rebased to the current vote epoch
+      if( _gstate4.rebasing )
+         return;
 
       auto idx = _producers.get_index<"prototalvote"_n>();
 
       std::vector< std::pair<eosio::producer_key,uint16_t> > top_producers;
-      top_producers.reserve(21);
+      top_producers.reserve( _gstate4.schedule_size );
 
-      for ( auto it = idx.cbegin(); it != idx.cend() && top_producers.size() < 21 && 0 < it->total_votes && it->active(); ++it ) {
+      for ( auto it = idx.cbegin(); it != idx.cend() && top_producers.size() < _gstate4.schedule_size && 0 < it->total_votes && it->active(); ++it ) {
          top_producers.emplace_back( std::pair<eosio::producer_key,uint16_t>({{it->owner, it->producer_key}, it->location}) );
       }
 
-      if ( top_producers.size() < _gstate.last_producer_schedule_size ) {
+      /// the schedule does not shrink unless its size is lowered
+      if ( top_producers.size() < std::min<uint32_t>( _gstate.last_producer_schedule_size, _gstate4.schedule_size ) ) {
          return;
       }
 
-      /// sort by producer name
-      std::sort( top_producers.begin(), top_producers.end() );
+      if( _gstate4.schedule_order == uint8_t(eosio_global_state4::schedule_orders::by_location) ) {
+         /// producers at the same location hand over to each other, ties are broken by producer name
+         std::sort( top_producers.begin(), top_producers.end(), []( const auto& a, const auto& b ) {
+            return std::tie( a.second, a.first.producer_name ) < std::tie( b.second, b.first.producer_name );
+         });
+      } else {
+         /// sort by producer name
+         std::sort( top_producers.begin(), top_producers.end() );
+      }
+
+      /// the elected set rarely changes between updates, only propose it when it differs from the last proposal
+      const auto schedule_hash = producer_schedule_hash( top_producers );
+      if( std::equal( std::begin(schedule_hash.hash), std::end(schedule_hash.hash),
+                      std::begin(_gstate4.last_proposed_schedule_hash.hash) ) ) {
+         return;
+      }
 
       std::vector<eosio::producer_key> producers;
 
@@ -116,13 +166,87 @@ namespace eosiosystem {
 
       if( set_proposed_producers( packed_schedule.data(),  packed_schedule.size() ) >= 0 ) {
          _gstate.last_producer_schedule_size = static_cast<decltype(_gstate.last_producer_schedule_size)>( top_producers.size() );
+         /// a new round starts with the new schedule
+         flush_round_blocks();
+         _gstate4.last_proposed_schedule_hash = schedule_hash;
+      } else if( std::all_of( std::begin(_gstate4.last_proposed_schedule_hash.hash),
+                              std::end(_gstate4.last_proposed_schedule_hash.hash), []( uint8_t b ) { return b == 0; } )
+                 && is_active_schedule( top_producers ) ) {
+         /// nothing was proposed since the upgrade that added the fingerprint, and the set is refused because it
+         /// is already active; it is remembered, or it would be proposed and refused again at every update
+         _gstate4.last_proposed_schedule_hash = schedule_hash;
       }
+      // otherwise the set is refused because it is already pending, or while an earlier proposal is still waiting
+      // to become pending; it is not remembered and is proposed again at the next update
+   }
+
+   int64_t weeks_since_epoch() {
+      return int64_t( (now() - (block_timestamp::block_timestamp_epoch / 1000)) / (seconds_per_day * 7) );
+   }
+
+   uint32_t current_vote_epoch() {
+      return uint32_t( weeks_since_epoch() / 52 );
+   }
+
+   /**
+    *  Vote weight of a stake in vote units, relative to the given vote epoch so that stored weights stay
+    *  within a factor of two of the stake instead of doubling every year.
+    */
+   int128_t stake2vote_units( int64_t staked, uint32_t vote_epoch ) {
+      return to_vote_units( double(staked) * vote_weight_multiplier( weeks_since_epoch() - 52 * int64_t(vote_epoch) ) );
    }
 
-   double stake2vote( int64_t staked ) {
-      /// TODO subtract 2080 brings the large numbers closer to this decade
-      double weight = int64_t( (now() - (block_timestamp::block_timestamp_epoch / 1000)) / (seconds_per_day * 7) )  / double( 52 );
-      return double(staked) * std::pow( 2, weight );
+   /**
+    *  Rebases the vote weights of a voter to the current vote epoch. Must be called before the weights
+    *  of a voter are read or updated.
+    */
+   void system_contract::rebase_voter( const voter_info& voter ) {
+      if( voter.vote_epoch != _gstate4.vote_epoch ) {
+         _voters.modify( voter, same_payer, [&]( auto& v ) {
+               v.rebase_votes( _gstate4.vote_epoch );
+            });
+      }
+   }
+
+   /**
+    *  Starts a new vote epoch once a year has passed since the current one. Global totals are rebased
+    *  right away; voters and producers are rebased when they are next touched, except for active producers,
+    *  which rebase_producers rebases before the next election. Waits for an unfinished recalculation or rebase.
+    */
+   void system_contract::roll_vote_epoch() {
+      const uint32_t epoch = current_vote_epoch();
+      if( epoch <= _gstate4.vote_epoch || _gstate4.recalc_phase != 0 || _gstate4.rebasing )
+         return;
+
+      const uint32_t years = epoch - _gstate4.vote_epoch;
+      _gstate4.total_producer_vote_units    = rebase_vote_units( _gstate4.total_producer_vote_units, years );
+      _gstate2.total_producer_votepay_share = std::ldexp( _gstate2.total_producer_votepay_share, -int(years) );
+      _gstate3.total_vpay_share_change_rate = std::ldexp( _gstate3.total_vpay_share_change_rate, -int(years) );
+      _gstate4.vote_epoch    = epoch;
+      _gstate4.rebasing      = true;
+      _gstate4.rebase_cursor = name();
+   }
+
+   /**
+    *  Rebases the votes of at most max_producers active producers, in producer name order, to the current
+    *  vote epoch. Inactive producers on the way are skipped, but count towards max_producers.
+    */
+   void system_contract::rebase_producers( uint32_t max_producers ) {
+      if( !_gstate4.rebasing )
+         return;
+
+      auto prod = _producers.lower_bound( _gstate4.rebase_cursor.value );
+      for( uint32_t i = 0; i < max_producers && prod != _producers.end(); ++i, ++prod ) {
+         if( prod->active() )
+            migrate_producer( *prod );
+      }
+
+      if( prod != _producers.end() ) {
+         _gstate4.rebase_cursor = prod->owner;
+      } else {
+         _gstate4.rebasing      = false;
+         _gstate4.rebase_cursor = name();
+      }
    }
 
    double system_contract::update_total_votepay_share( time_point ct,
@@ -153,29 +277,399 @@ namespace eosiosystem {
       return _gstate2.total_producer_votepay_share;
    }
 
-   double system_contract::update_producer_votepay_share( const producers_table2::const_iterator& prod_itr,
+   /**
+    *  Accrues the votepay share of a producer up to ct. Only updates the row in place, so it must be
+    *  called from within the modification of the producer row.
+    *
+    *  @pre prod has votepay state
+    */
+   double system_contract::update_producer_votepay_share( producer_info& prod,
                                                           time_point ct,
                                                           double shares_rate,
                                                           bool reset_to_zero )
    {
       double delta_votepay_share = 0.0;
-      if( shares_rate > 0.0 && ct > prod_itr->last_votepay_share_update ) {
-         delta_votepay_share = shares_rate * double( (ct - prod_itr->last_votepay_share_update).count() / 1E6 ); // cannot be negative
+      if( shares_rate > 0.0 && ct > prod.last_votepay_share_update.value() ) {
+         delta_votepay_share = shares_rate * double( (ct - prod.last_votepay_share_update.value()).count() / 1E6 ); // cannot be negative
       }
 
-      double new_votepay_share = prod_itr->votepay_share + delta_votepay_share;
-      _producers2.modify( prod_itr, same_payer, [&](auto& p) {
-         if( reset_to_zero )
-            p.votepay_share = 0.0;
-         else
-            p.votepay_share = new_votepay_share;
-
-         p.last_votepay_share_update = ct;
-      } );
+      double new_votepay_share = prod.votepay_share.value() + delta_votepay_share;
+      prod.set_votepay_share( reset_to_zero ? 0.0 : new_votepay_share, ct );
 
       return new_votepay_share;
    }
 
+   /**
+    *  Adds delta vote units to the votes of a producer, accruing its votepay share up to ct beforehand. The resulting
+    *  changes of the global votepay share are accumulated into delta_change_rate and total_inactive_vpay_share,
+    *  which the caller applies with update_total_votepay_share once all producers have been updated.
+    */
+   void system_contract::update_producer_votes( const producer_info& prod, int128_t delta, time_point ct,
+                                                double& delta_change_rate, double& total_inactive_vpay_share )
+   {
+      migrate_producer( prod );
+      const bool has_votepay_share = prod.has_votepay_share();
+      const auto last_claim_plus_3days = prod.last_claim_time + microseconds(3 * useconds_per_day);
+      bool crossed_threshold       = (last_claim_plus_3days <= ct);
+      bool updated_after_threshold = has_votepay_share && (last_claim_plus_3days <= prod.last_votepay_share_update.value());
+      // Note: updated_after_threshold implies cross_threshold
+
+      const double   init_total_votes = prod.total_votes;
+      const int128_t new_vote_units   = prod.vote_units() + delta;
+      double new_votepay_share = 0.0;
+      _producers.modify( prod, same_payer, [&]( auto& p ) {
+         if( has_votepay_share ) {
+            new_votepay_share = update_producer_votepay_share( p,
+                                   ct,
+                                   updated_after_threshold ? 0.0 : init_total_votes,
+                                   crossed_threshold && !updated_after_threshold // only reset votepay_share once after threshold
+                                );
+         }
+         // tallies are rebased rounding down, so they stay at least the sum of their votes; only a tally derived
+         // from the total_votes of a row older than version 2 can be below it
+         p.set_vote_units( new_vote_units > 0 ? new_vote_units : 0 );
+      });
+      _gstate4.total_producer_vote_units += delta;
+
+      if( has_votepay_share ) {
+         if( !crossed_threshold ) {
+            delta_change_rate += from_vote_units( delta );
+         } else if( !updated_after_threshold ) {
+            total_inactive_vpay_share += new_votepay_share;
+            delta_change_rate -= init_total_votes;
+         }
+      }
+   }
+
+   /**
+    *  Keeps the tallies of a vote recalculation in progress in step with a vote change that has just
+    *  been applied to a producer. While voters are summed, only voters that were already summed are
+    *  recorded. While tallies are written, producers still to be written get the change in their tally
+    *  and those already written get it in the rebuilt total.
+    */
+   void system_contract::record_vote_delta( const name voter, const name producer, int128_t delta ) {
+      if( _gstate4.recalc_phase == 1 && !( voter < _gstate4.recalc_cursor ) )
+         return;
+      record_tally_delta( producer, delta );
+   }
+
+   /**
+    *  Records a vote change of a producer that is known to concern voters already summed by a vote
+    *  recalculation in progress, see record_vote_delta.
+    */
+   void system_contract::record_tally_delta( const name producer, int128_t delta ) {
+      if( _gstate4.recalc_phase == 0 )
+         return;
+
+      if( _gstate4.recalc_phase == 2 && producer < _gstate4.recalc_cursor ) {
+         _gstate4.recalc_total_vote_units += delta;
+         return;
+      }
+
+      vote_tally_table tallies( _self, _self.value );
+      auto tally = tallies.find( producer.value );
+      if( tally == tallies.end() ) {
+         tallies.emplace( _self, [&]( auto& t ) {
+               t.owner            = producer;
+               t.total_vote_units = delta;
+            });
+      } else {
+         tallies.modify( tally, same_payer, [&]( auto& t ) {
+               t.total_vote_units += delta;
+            });
+      }
+   }
+
+   /**
+    *  Erases the tallies, below the given producer, of votes for producers that no longer exist
+    *  because gcproducers erased them.
+    */
+   void erase_orphan_tallies( vote_tally_table& tallies, const name producer ) {
+      for( auto tally = tallies.begin(); tally != tallies.end() && tally->owner < producer; tally = tallies.begin() ) {
+         tallies.erase( tally );
+      }
+   }
+
+   void system_contract::recalcvotes( const name cursor, uint32_t limit ) {
+      require_auth( _self );
+      eosio_assert( limit > 0, "limit must be positive" );
+      eosio_assert( cursor == _gstate4.recalc_cursor, "cursor does not match the recalculation in progress" );
+
+      vote_tally_table tallies( _self, _self.value );
+      if( _gstate4.recalc_phase == 0 ) {
+         eosio_assert( tallies.begin() == tallies.end(), "vote tallies of a previous recalculation remain" ); //data corruption
+         _gstate4.recalc_phase = 1;
+      }
+
+      uint32_t count = 0;
+      if( _gstate4.recalc_phase == 1 ) {
+         auto voter = _voters.lower_bound( cursor.value );
+         for( ; voter != _voters.end() && count < limit; ++voter, ++count ) {
+            if( voter->proxy || voter->vote_units() <= 0 )
+               continue;
+            rebase_voter( *voter );
+            const int128_t vote_units = voter->vote_units();
+            for( const auto& p : voter_producers( *voter ) ) {
+               auto tally = tallies.find( p.value );
+               if( tally == tallies.end() ) {
+                  tallies.emplace( _self, [&]( auto& t ) {
+                        t.owner            = p;
+                        t.total_vote_units = vote_units;
+                     });
+               } else {
+                  tallies.modify( tally, same_payer, [&]( auto& t ) {
+                        t.total_vote_units += vote_units;
+                     });
+               }
+            }
+         }
+
+         if( voter != _voters.end() ) {
+            _gstate4.recalc_cursor = voter->owner;
+         } else {
+            _gstate4.recalc_phase            = 2;
+            _gstate4.recalc_cursor           = name();
+            _gstate4.recalc_total_vote_units = 0;
+         }
+         return;
+      }
+
+      const auto ct = current_time_point();
+      double delta_change_rate         = 0;
+      double total_inactive_vpay_share = 0;
+      auto prod = _producers.lower_bound( cursor.value );
+      for( ; prod != _producers.end() && count < limit; ++prod, ++count ) {
+         erase_orphan_tallies( tallies, prod->owner );
+         migrate_producer( *prod );
+         int128_t vote_units = 0;
+         auto tally = tallies.find( prod->owner.value );
+         if( tally != tallies.end() ) {
+            vote_units = tally->total_vote_units;
+            tallies.erase( tally );
+         }
+         if( vote_units != prod->vote_units() ) {
+            update_producer_votes( *prod, vote_units - prod->vote_units(), ct, delta_change_rate, total_inactive_vpay_share );
+         }
+         _gstate4.recalc_total_vote_units += vote_units;
+      }
+      update_total_votepay_share( ct, -total_inactive_vpay_share, delta_change_rate );
+
+      if( prod != _producers.end() ) {
+         _gstate4.recalc_cursor = prod->owner;
+      } else {
+         erase_orphan_tallies( tallies, name( std::numeric_limits<uint64_t>::max() ) );
+         /// the sum of all tallies replaces the accumulated total as well
+         _gstate4.total_producer_vote_units = _gstate4.recalc_total_vote_units;
+         _gstate4.recalc_phase            = 0;
+         _gstate4.recalc_cursor           = name();
+         _gstate4.recalc_total_vote_units = 0;
+      }
+   }
+
+   /**
+    *  Brings the row of a producer up to date: moves its votepay state from its legacy producers2 row, if any,
+    *  into its producers row and rebases its votes to the current vote epoch. Must be called before the votes
+    *  or votepay share of a producer are read or updated.
+    */
+   void system_contract::migrate_producer( const producer_info& prod ) {
+      const bool rebase = prod.votes_epoch() != _gstate4.vote_epoch;
+      auto prod2 = prod.has_votepay_share() ? _producers2.end() : _producers2.find( prod.owner.value );
+      if( !rebase && prod2 == _producers2.end() )
+         return;
+
+      /// the legacy votepay state is relative to epoch 0, the row may have been rebased without it already
+      _producers.modify( prod, same_payer, [&]( producer_info& info ) {
+         if( prod2 != _producers2.end() )
+            info.set_votepay_share( std::ldexp( prod2->votepay_share, -int(info.votes_epoch()) ), prod2->last_votepay_share_update );
+         if( rebase )
+            info.rebase_votes( _gstate4.vote_epoch );
+      });
+      if( prod2 != _producers2.end() )
+         _producers2.erase( prod2 );
+   }
+
+   void system_contract::migrateprods( uint16_t max_producers ) {
+      eosio_assert( max_producers > 0, "max_producers must be positive" );
+      auto prod2 = _producers2.begin();
+      for( uint16_t i = 0; i < max_producers && prod2 != _producers2.end(); ++i ) {
+         auto prod = _producers.find( prod2->owner.value );
+         if( prod != _producers.end() && !prod->has_votepay_share() ) {
+            _producers.modify( prod, same_payer, [&]( producer_info& info ) {
+               info.set_votepay_share( std::ldexp( prod2->votepay_share, -int(info.votes_epoch()) ), prod2->last_votepay_share_update );
+            });
+         }
+         prod2 = _producers2.erase( prod2 );
+      }
+   }
+
+   void system_contract::update_vote_count( const name owner, int32_t voters_delta, int32_t delegators_delta ) {
+      vote_counts_table counts( _self, _self.value );
+      auto count = counts.find( owner.value );
+      if( count == counts.end() ) {
+         eosio_assert( voters_delta >= 0 && delegators_delta >= 0, "vote count not found" ); //data corruption
+         counts.emplace( _self, [&]( auto& c ) {
+               c.owner           = owner;
+               c.voter_count     = voters_delta;
+               c.delegator_count = delegators_delta;
+            });
+      } else if( count->voter_count + voters_delta == 0 && count->delegator_count + delegators_delta == 0 ) {
+         counts.erase( count );
+      } else {
+         counts.modify( count, same_payer, [&]( auto& c ) {
+               c.voter_count     += voters_delta;
+               c.delegator_count += delegators_delta;
+            });
+      }
+   }
+
+   /**
+    *  The producers a voter votes for, sorted by name. Rows of version 1 list them by id, the ids of
+    *  producers erased by gcproducers still resolve to their names.
+    */
+   std::vector<name> system_contract::voter_producers( const voter_info& voter ) {
+      if( !voter.lists_producer_ids() )
+         return voter.producers;
+
+      producer_ids_table registry( _self, _self.value );
+      std::vector<name> producers;
+      for( const auto id : decode_producer_ids( voter.producer_ids.value() ) ) {
+         producers.push_back( registry.get( id, "producer id is not registered" ).owner ); //data corruption
+      }
+      std::sort( producers.begin(), producers.end() );
+      return producers;
+   }
+
+   /**
+    *  The id of a producer, assigning it the next id if it has none yet. The new registry row is billed to payer.
+    */
+   uint32_t system_contract::producer_id_of( const producer_info& prod, const name payer ) {
+      if( prod.producer_id.has_value() )
+         return prod.producer_id.value();
+
+      const uint32_t id = _gstate4.next_producer_id++;
+      producer_ids_table registry( _self, _self.value );
+      registry.emplace( payer, [&]( auto& r ) {
+            r.id    = id;
+            r.owner = prod.owner;
+         });
+      _producers.modify( prod, same_payer, [&]( auto& p ) {
+            p.set_producer_id( id );
+         });
+      return id;
+   }
+
+   /**
+    *  Records the proxy a voter delegates to, or that it no longer delegates if proxy is empty. A new row
+    *  is billed to payer.
+    */
+   void system_contract::update_delegation( const name voter, const name proxy, const name payer ) {
+      delegations_table delegations( _self, _self.value );
+      auto itr = delegations.find( voter.value );
+      if( !proxy ) {
+         if( itr != delegations.end() )
+            delegations.erase( itr );
+      } else if( itr == delegations.end() ) {
+         delegations.emplace( payer, [&]( auto& d ) {
+               d.owner = voter;
+               d.proxy = proxy;
+            });
+      } else {
+         delegations.modify( itr, same_payer, [&]( auto& d ) {
+               d.proxy = proxy;
+            });
+      }
+   }
+
+   void system_contract::refreshproxy( const name proxy, const name cursor, uint16_t limit ) {
+      require_auth( proxy );
+      eosio_assert( limit > 0, "limit must be positive" );
+      eosio_assert( _gstate4.counts_built, "delegations are not recorded yet" );
+
+      delegations_table delegations( _self, _self.value );
+      auto idx = delegations.get_index<"byproxy"_n>();
+      auto itr = idx.lower_bound( (uint128_t(proxy.value) << 64) | cursor.value );
+      for( uint16_t i = 0; i < limit && itr != idx.end() && itr->proxy == proxy; ++i, ++itr ) {
+         propagate_weight_change( _voters.get( itr->owner.value, "delegator not found" ) ); //data corruption
+      }
+   }
+
+   void system_contract::refreshvotes( const std::vector<name>& voters ) {
+      /// summed changes of the producers voted for, the recorded part concerns voters already summed by recalcvotes
+      struct producer_delta {
+         int128_t value    = 0;
+         int128_t recorded = 0;
+      };
+      std::map<name, producer_delta> producer_deltas;
+
+      for( const auto& voter_name : voters ) {
+         require_auth( voter_name );
+         const auto& voter = _voters.get( voter_name.value, "user must stake before they can vote" );
+         eosio_assert( voter.has_producers() || voter.proxy, "voter has no votes to refresh" );
+         rebase_voter( voter );
+
+         int128_t new_vote_units = stake2vote_units( voter.staked, _gstate4.vote_epoch );
+         if( voter.is_proxy ) {
+            new_vote_units += voter.proxied_units();
+         }
+         const int128_t new_units  = ( new_vote_units >= 0 ? new_vote_units : 0 );
+         const int128_t last_units = ( voter.vote_units() > 0 ? voter.vote_units() : 0 );
+
+         if( voter.proxy ) {
+            adjust_proxied_weight( voter.proxy, new_units - last_units );
+         } else {
+            const int128_t delta    = new_units - last_units;
+            const bool     recorded = ( _gstate4.recalc_phase != 1 || voter_name < _gstate4.recalc_cursor );
+            for( const auto& p : voter_producers( voter ) ) {
+               auto& pd = producer_deltas[p];
+               pd.value += delta;
+               if( recorded )
+                  pd.recorded += delta;
+               record_vote_event( voter_name, p, delta );
+            }
+         }
+
+         _voters.modify( voter, same_payer, [&]( auto& v ) {
+               v.set_vote_units( new_vote_units );
+            });
+         update_vote_age( voter_name, true, voter_name );
+      }
+
+      const auto ct = current_time_point();
+      double delta_change_rate         = 0.0;
+      double total_inactive_vpay_share = 0.0;
+      for( const auto& item : producer_deltas ) {
+         auto prod = _producers.find( item.first.value );
+         if( prod == _producers.end() ) // erased by gcproducers
+            continue;
+         if( item.second.value != 0 )
+            update_producer_votes( *prod, item.second.value, ct, delta_change_rate, total_inactive_vpay_share );
+         if( item.second.recorded != 0 )
+            record_tally_delta( item.first, item.second.recorded );
+      }
+      update_total_votepay_share( ct, -total_inactive_vpay_share, delta_change_rate );
+   }
+
+   void system_contract::buildcounts( uint16_t max_voters ) {
+      eosio_assert( max_voters > 0, "max_voters must be positive" );
+      eosio_assert( !_gstate4.counts_built, "vote counts are already built" );
+      auto voter = _voters.lower_bound( _gstate4.count_cursor.value );
+      for( uint16_t i = 0; i < max_voters && voter != _voters.end(); ++i, ++voter ) {
+         for( const auto& p : voter_producers( *voter ) ) {
+            update_vote_count( p, 1, 0 );
+         }
+         if( voter->proxy ) {
+            update_vote_count( voter->proxy, 0, 1 );
+            update_delegation( voter->owner, voter->proxy, _self );
+         }
+      }
+      if( voter != _voters.end() ) {
+         _gstate4.count_cursor = voter->owner;
+      } else {
+         _gstate4.counts_built = true;
+         _gstate4.count_cursor = name();
+      }
+   }
+
    /**
     *  @pre producers must be sorted from lowest to highest and must be registered and active
     *  @pre if proxy is set then no producers can be voted for
@@ -194,10 +688,10 @@ namespace eosiosystem {
     */
    void system_contract::voteproducer( const name voter_name, const name proxy, const std::vector<name>& producers ) {
       require_auth( voter_name );
-      update_votes( voter_name, proxy, producers, true );
+      update_votes( voter_name, proxy, producers );
    }
 
-   void system_contract::update_votes( const name voter_name, const name proxy, const std::vector<name>& producers, bool voting ) {
+   void system_contract::update_votes( const name voter_name, const name proxy, const std::vector<name>& producers ) {
       //validate input
       if ( proxy ) {
          eosio_assert( producers.size() == 0, "cannot vote for producers and proxy at same time" );
@@ -212,110 +706,122 @@ namespace eosiosystem {
       auto voter = _voters.find( voter_name.value );
       eosio_assert( voter != _voters.end(), "user must stake before they can vote" ); /// staking creates voter object
       eosio_assert( !proxy || !voter->is_proxy, "account registered as a proxy is not allowed to use a proxy" );
+      rebase_voter( *voter );
 
       /**
        * The first time someone votes we calculate and set last_vote_weight, since they cannot unstake until
        * after total_activated_stake hits threshold, we can use last_vote_weight to determine that this is
        * their first vote and should consider their stake activated.
        */
-      if( voter->last_vote_weight <= 0.0 ) {
+      if( voter->vote_units() <= 0 ) {
          _gstate.total_activated_stake += voter->staked;
          if( _gstate.total_activated_stake >= min_activated_stake && _gstate.thresh_activated_stake_time == time_point() ) {
             _gstate.thresh_activated_stake_time = current_time_point();
          }
       }
 
-      auto new_vote_weight = stake2vote( voter->staked );
+      int128_t new_vote_units = stake2vote_units( voter->staked, _gstate4.vote_epoch );
       if( voter->is_proxy ) {
-         new_vote_weight += voter->proxied_vote_weight;
+         new_vote_units += voter->proxied_units();
       }
 
-      boost::container::flat_map<name, pair<double, bool /*new*/> > producer_deltas;
-      if ( voter->last_vote_weight > 0 ) {
+      bool remove_old_votes = false;
+      if ( voter->vote_units() > 0 ) {
          if( voter->proxy ) {
-            auto old_proxy = _voters.find( voter->proxy.value );
-            eosio_assert( old_proxy != _voters.end(), "old proxy not found" ); //data corruption
-            _voters.modify( old_proxy, same_payer, [&]( auto& vp ) {
-                  vp.proxied_vote_weight -= voter->last_vote_weight;
-               });
-            propagate_weight_change( *old_proxy );
+            adjust_proxied_weight( voter->proxy, -voter->vote_units() );
          } else {
-            for( const auto& p : voter->producers ) {
-               auto& d = producer_deltas[p];
-               d.first -= voter->last_vote_weight;
-               d.second = false;
-            }
+            remove_old_votes = true;
          }
       }
 
+      bool add_new_votes = false;
       if( proxy ) {
          auto new_proxy = _voters.find( proxy.value );
-         eosio_assert( new_proxy != _voters.end(), "invalid proxy specified" ); //if ( !voting ) { data corruption } else { wrong vote }
-         eosio_assert( !voting || new_proxy->is_proxy, "proxy not found" );
-         if ( new_vote_weight >= 0 ) {
-            _voters.modify( new_proxy, same_payer, [&]( auto& vp ) {
-                  vp.proxied_vote_weight += new_vote_weight;
-               });
-            propagate_weight_change( *new_proxy );
+         eosio_assert( new_proxy != _voters.end(), "invalid proxy specified" );
+         eosio_assert( new_proxy->is_proxy, "proxy not found" );
+         if ( new_vote_units >= 0 ) {
+            adjust_proxied_weight( proxy, new_vote_units );
          }
       } else {
-         if( new_vote_weight >= 0 ) {
-            for( const auto& p : producers ) {
-               auto& d = producer_deltas[p];
-               d.first += new_vote_weight;
-               d.second = true;
+         add_new_votes = ( new_vote_units >= 0 );
+      }
+
+      /// both producer lists are sorted, so the deltas are built by merging them in a single pass
+      /// the new set is always voted for (add_new_votes), the old set only while its votes are counted (remove_old_votes)
+      struct producer_delta {
+         name     producer;
+         int128_t value  = 0;     ///< in vote units
+         bool     is_new = false; ///< producer is in the new set
+         int8_t   voters = 0;     ///< change of the number of voters listing the producer
+      };
+      std::array<producer_delta, 2 * 30> producer_deltas;
+      size_t num_deltas = 0;
+      {
+         const int128_t removed_units = remove_old_votes ? voter->vote_units() : 0;
+         const int128_t added_units   = add_new_votes ? new_vote_units : 0;
+         const auto old_producers = voter_producers( *voter );
+         auto old_itr = old_producers.begin();
+         auto old_end = old_producers.end();
+         auto new_itr = producers.begin();
+         auto new_end = producers.end();
+         while( old_itr != old_end || new_itr != new_end ) {
+            eosio_assert( num_deltas < producer_deltas.size(), "too many producer votes" ); //data corruption
+            auto& d = producer_deltas[num_deltas++];
+            if( new_itr == new_end || ( old_itr != old_end && *old_itr < *new_itr ) ) {
+               d = { *old_itr++, -removed_units, false, -1 };
+            } else if( old_itr == old_end || *new_itr < *old_itr ) {
+               d = { *new_itr++, added_units, true, 1 };
+            } else {
+               d = { *new_itr++, added_units - removed_units, true, 0 };
+               ++old_itr;
             }
          }
       }
 
+      /// voters that buildcounts has not visited yet are counted when it does
+      const bool counted = _gstate4.counts_built || voter_name < _gstate4.count_cursor;
+      if( counted && voter->proxy != proxy ) {
+         if( voter->proxy )
+            update_vote_count( voter->proxy, 0, -1 );
+         if( proxy )
+            update_vote_count( proxy, 0, 1 );
+         update_delegation( voter_name, proxy, voter_name );
+      }
+
       const auto ct = current_time_point();
       double delta_change_rate         = 0.0;
       double total_inactive_vpay_share = 0.0;
-      for( const auto& pd : producer_deltas ) {
-         auto pitr = _producers.find( pd.first.value );
+      std::vector<uint32_t> producer_ids;
+      producer_ids.reserve( producers.size() );
+      for( size_t i = 0; i < num_deltas; ++i ) {
+         const auto& pd = producer_deltas[i];
+         if( counted && pd.voters != 0 )
+            update_vote_count( pd.producer, pd.voters, 0 );
+         if( !pd.is_new && !remove_old_votes )
+            continue;
+         auto pitr = _producers.find( pd.producer.value );
          if( pitr != _producers.end() ) {
-            eosio_assert( !voting || pitr->active() || !pd.second.second /* not from new set */, "producer is not currently registered" );
-            double init_total_votes = pitr->total_votes;
-            _producers.modify( pitr, same_payer, [&]( auto& p ) {
-               p.total_votes += pd.second.first;
-               if ( p.total_votes < 0 ) { // floating point arithmetics can give small negative numbers
-                  p.total_votes = 0;
-               }
-               _gstate.total_producer_vote_weight += pd.second.first;
-               //eosio_assert( p.total_votes >= 0, "something bad happened" );
-            });
-            auto prod2 = _producers2.find( pd.first.value );
-            if( prod2 != _producers2.end() ) {
-               const auto last_claim_plus_3days = pitr->last_claim_time + microseconds(3 * useconds_per_day);
-               bool crossed_threshold       = (last_claim_plus_3days <= ct);
-               bool updated_after_threshold = (last_claim_plus_3days <= prod2->last_votepay_share_update);
-               // Note: updated_after_threshold implies cross_threshold
-
-               double new_votepay_share = update_producer_votepay_share( prod2,
-                                             ct,
-                                             updated_after_threshold ? 0.0 : init_total_votes,
-                                             crossed_threshold && !updated_after_threshold // only reset votepay_share once after threshold
-                                          );
-
-               if( !crossed_threshold ) {
-                  delta_change_rate += pd.second.first;
-               } else if( !updated_after_threshold ) {
-                  total_inactive_vpay_share += new_votepay_share;
-                  delta_change_rate -= init_total_votes;
-               }
-            }
+            eosio_assert( pitr->active() || !pd.is_new /* not from new set */, "producer is not currently registered" );
+            update_producer_votes( *pitr, pd.value, ct, delta_change_rate, total_inactive_vpay_share );
+            record_vote_delta( voter_name, pd.producer, pd.value );
+            record_vote_event( voter_name, pd.producer, pd.value );
+            if( pd.is_new )
+               producer_ids.push_back( producer_id_of( *pitr, _self ) ); // producers registered before ids existed get one now
          } else {
-            eosio_assert( !pd.second.second /* not from new set */, "producer is not registered" ); //data corruption
+            eosio_assert( !pd.is_new /* not from new set */, "producer is not registered" ); //data corruption
          }
       }
 
       update_total_votepay_share( ct, -total_inactive_vpay_share, delta_change_rate );
 
+      /// the row is converted to, or stays at, version 1, which lists the producers by id
+      std::sort( producer_ids.begin(), producer_ids.end() );
       _voters.modify( voter, same_payer, [&]( auto& av ) {
-         av.last_vote_weight = new_vote_weight;
-         av.producers = producers;
+         av.set_vote_units( new_vote_units );
+         av.set_producer_ids( producer_ids );
          av.proxy     = proxy;
       });
+      update_vote_age( voter_name, producers.size() || proxy, voter_name );
    }
 
    /**
@@ -323,6 +829,9 @@ namespace eosiosystem {
     *  have selected it as a proxy. Other accounts must refresh their voteproducer to
     *  update the proxy's weight.
     *
+    *  The producers voted for by the proxy are updated once the queued weight change
+    *  of the proxy is flushed.
+    *
     *  @param isproxy - true if proxy wishes to vote on behalf of others, false otherwise
     *  @pre proxy must have something staked (existing row in voters table)
     *  @pre new state must be different than current state
@@ -337,72 +846,269 @@ namespace eosiosystem {
          _voters.modify( pitr, same_payer, [&]( auto& p ) {
                p.is_proxy = isproxy;
             });
-         propagate_weight_change( *pitr );
+         queue_weight_change( *pitr );
       } else {
          _voters.emplace( proxy, [&]( auto& p ) {
-               p.owner  = proxy;
-               p.is_proxy = isproxy;
+               p.owner      = proxy;
+               p.is_proxy   = isproxy;
+               p.vote_epoch = _gstate4.vote_epoch;
             });
       }
    }
 
+   /**
+    *  Applies a change of the stake of a voter to the vote they cast. The producers and proxy voted for
+    *  are unchanged, so unlike update_votes there is nothing to validate or merge: every producer, or the
+    *  proxy, receives the difference between the new and the last vote weight, and the voter row is
+    *  written once with both the new stake and the new vote weight.
+    */
+   void system_contract::update_voter_stake( const voter_info& voter, int64_t stake_delta ) {
+      const int64_t staked = voter.staked + stake_delta;
+      rebase_voter( voter );
+
+      /// see update_votes, a voter without vote weight has not had their stake activated yet
+      if( voter.vote_units() <= 0 ) {
+         _gstate.total_activated_stake += staked;
+         if( _gstate.total_activated_stake >= min_activated_stake && _gstate.thresh_activated_stake_time == time_point() ) {
+            _gstate.thresh_activated_stake_time = current_time_point();
+         }
+      }
+
+      int128_t new_vote_units = stake2vote_units( staked, _gstate4.vote_epoch );
+      if( voter.is_proxy ) {
+         new_vote_units += voter.proxied_units();
+      }
+      const int128_t new_units  = ( new_vote_units >= 0 ? new_vote_units : 0 );
+      const int128_t last_units = ( voter.vote_units() > 0 ? voter.vote_units() : 0 );
+
+      if( voter.proxy ) {
+         adjust_proxied_weight( voter.proxy, new_units - last_units );
+      } else {
+         const int128_t delta = new_units - last_units;
+         if( delta != 0 ) {
+            const auto ct = current_time_point();
+            double delta_change_rate         = 0.0;
+            double total_inactive_vpay_share = 0.0;
+            for( const auto& p : voter_producers( voter ) ) {
+               auto prod = _producers.find( p.value );
+               if( prod == _producers.end() ) // erased by gcproducers
+                  continue;
+               update_producer_votes( *prod, delta, ct, delta_change_rate, total_inactive_vpay_share );
+               record_vote_delta( voter.owner, p, delta );
+               record_vote_event( voter.owner, p, delta );
+            }
+            update_total_votepay_share( ct, -total_inactive_vpay_share, delta_change_rate );
+         }
+      }
+
+      _voters.modify( voter, same_payer, [&]( auto& v ) {
+            v.set_vote_units( new_vote_units );
+            v.staked = staked;
+         });
+      update_vote_age( voter.owner, true, voter.owner );
+   }
+
    void system_contract::propagate_weight_change( const voter_info& voter ) {
       eosio_assert( !voter.proxy || !voter.is_proxy, "account registered as a proxy is not allowed to use a proxy" );
-      double new_weight = stake2vote( voter.staked );
+      rebase_voter( voter );
+
+      /// the weight of a voter without producers or a proxy is not cast, such as that of a proxy that has not
+      /// voted itself; last_vote_weight is left alone, so that it still tells whether the voter ever voted
+      if( !voter.proxy && !voter.has_producers() ) {
+         update_vote_age( voter.owner, false, name() );
+         return;
+      }
+
+      int128_t new_units = stake2vote_units( voter.staked, _gstate4.vote_epoch );
       if ( voter.is_proxy ) {
-         new_weight += voter.proxied_vote_weight;
+         new_units += voter.proxied_units();
       }
 
-      /// don't propagate small changes (1 ~= epsilon)
-      if ( fabs( new_weight - voter.last_vote_weight ) > 1 )  {
-         if ( voter.proxy ) {
-            auto& proxy = _voters.get( voter.proxy.value, "proxy not found" ); //data corruption
-            _voters.modify( proxy, same_payer, [&]( auto& p ) {
-                  p.proxied_vote_weight += new_weight - voter.last_vote_weight;
-               }
-            );
-            propagate_weight_change( proxy );
-         } else {
-            auto delta = new_weight - voter.last_vote_weight;
-            const auto ct = current_time_point();
-            double delta_change_rate         = 0;
-            double total_inactive_vpay_share = 0;
-            for ( auto acnt : voter.producers ) {
-               auto& prod = _producers.get( acnt.value, "producer not found" ); //data corruption
-               const double init_total_votes = prod.total_votes;
-               _producers.modify( prod, same_payer, [&]( auto& p ) {
-                  p.total_votes += delta;
-                  _gstate.total_producer_vote_weight += delta;
-               });
-               auto prod2 = _producers2.find( acnt.value );
-               if ( prod2 != _producers2.end() ) {
-                  const auto last_claim_plus_3days = prod.last_claim_time + microseconds(3 * useconds_per_day);
-                  bool crossed_threshold       = (last_claim_plus_3days <= ct);
-                  bool updated_after_threshold = (last_claim_plus_3days <= prod2->last_votepay_share_update);
-                  // Note: updated_after_threshold implies cross_threshold
-
-                  double new_votepay_share = update_producer_votepay_share( prod2,
-                                                ct,
-                                                updated_after_threshold ? 0.0 : init_total_votes,
-                                                crossed_threshold && !updated_after_threshold // only reset votepay_share once after threshold
-                                             );
-
-                  if( !crossed_threshold ) {
-                     delta_change_rate += delta;
-                  } else if( !updated_after_threshold ) {
-                     total_inactive_vpay_share += new_votepay_share;
-                     delta_change_rate -= init_total_votes;
-                  }
-               }
+      /// weights are kept in integer vote units, so every change is propagated and none is lost to an epsilon
+      const int128_t delta = new_units - voter.vote_units();
+      if ( voter.proxy ) {
+         adjust_proxied_weight( voter.proxy, delta );
+      } else if( delta != 0 ) {
+         const auto ct = current_time_point();
+         double delta_change_rate         = 0;
+         double total_inactive_vpay_share = 0;
+         for ( auto acnt : voter_producers( voter ) ) {
+            auto prod = _producers.find( acnt.value );
+            if( prod == _producers.end() ) // erased by gcproducers
+               continue;
+            update_producer_votes( *prod, delta, ct, delta_change_rate, total_inactive_vpay_share );
+            record_vote_delta( voter.owner, acnt, delta );
+            record_vote_event( voter.owner, acnt, delta );
+         }
+
+         update_total_votepay_share( ct, -total_inactive_vpay_share, delta_change_rate );
+      }
+      if( delta != 0 ) {
+         _voters.modify( voter, same_payer, [&]( auto& v ) {
+               v.set_vote_units( new_units );
             }
+         );
+      }
+      /// there is no voter authority to bill a new row to, a voter without a vote age gets one when it votes again
+      /// or from record_vote_ages
+      update_vote_age( voter.owner, true, name() );
+   }
 
-            update_total_votepay_share( ct, -total_inactive_vpay_share, delta_change_rate );
+   /**
+    *  Appends a vote event, overwriting the oldest event once the ring is full.
+    */
+   void system_contract::record_vote_event( const name voter, const name producer, int128_t delta ) {
+      if( delta == 0 )
+         return;
+
+      vote_events_table events( _self, _self.value );
+      const uint64_t seq = _gstate4.vote_event_seq++;
+      auto itr = events.find( seq % vote_event_capacity );
+      if( itr == events.end() ) {
+         events.emplace( _self, [&]( auto& e ) {
+               e.seq      = seq;
+               e.voter    = voter;
+               e.producer = producer;
+               e.delta    = delta;
+            });
+      } else {
+         events.modify( itr, same_payer, [&]( auto& e ) {
+               e.seq      = seq;
+               e.voter    = voter;
+               e.producer = producer;
+               e.delta    = delta;
+            });
+      }
+   }
+
+   /**
+    *  Records when the vote weight of a voter was last computed, or forgets the voter once it
+    *  votes for neither producers nor a proxy. Voters are only tracked while refreshing is enabled.
+    *  A new row is billed to payer; without a payer only an existing row is updated.
+    */
+   void system_contract::update_vote_age( const name voter, bool has_votes, const name payer ) {
+      if( _gstate4.vote_refreshes_per_block == 0 )
+         return;
+
+      vote_ages_table vote_ages( _self, _self.value );
+      auto itr = vote_ages.find( voter.value );
+      if( !has_votes ) {
+         if( itr != vote_ages.end() )
+            vote_ages.erase( itr );
+      } else if( itr == vote_ages.end() ) {
+         if( !payer )
+            return;
+         vote_ages.emplace( payer, [&]( auto& a ) {
+               a.owner            = voter;
+               a.last_vote_update = current_time_point();
+            });
+      } else if( itr->last_vote_update != current_time_point() ) {
+         vote_ages.modify( itr, same_payer, [&]( auto& a ) {
+               a.last_vote_update = current_time_point();
+            });
+      }
+   }
+
+   /**
+    *  Records a vote age for at most max_voters voters, in the order of the voters table, that vote for producers
+    *  or a proxy but have no vote age, such as the voters that voted while refreshing was disabled.
+    */
+   void system_contract::record_vote_ages( uint32_t max_voters ) {
+      if( !_gstate4.aging )
+         return;
+
+      vote_ages_table vote_ages( _self, _self.value );
+      auto voter = _voters.lower_bound( _gstate4.age_cursor.value );
+      for( uint32_t i = 0; i < max_voters && voter != _voters.end(); ++i, ++voter ) {
+         if( ( voter->has_producers() || voter->proxy ) && vote_ages.find( voter->owner.value ) == vote_ages.end() ) {
+            /// written in onblock without the voter's authority, so the row is billed to the contract
+            vote_ages.emplace( _self, [&]( auto& a ) {
+                  a.owner = voter->owner; // when the weight was computed is unknown, so it is refreshed first
+               });
          }
       }
-      _voters.modify( voter, same_payer, [&]( auto& v ) {
-            v.last_vote_weight = new_weight;
+      if( voter != _voters.end() ) {
+         _gstate4.age_cursor = voter->owner;
+      } else {
+         _gstate4.aging      = false;
+         _gstate4.age_cursor = name();
+      }
+   }
+
+   /**
+    *  Recomputes the vote weight of at most max_voters voters whose weight was last computed before
+    *  the start of the current week, stalest first. Vote weights only change from one week to the next.
+    */
+   uint32_t system_contract::refresh_stale_votes( uint32_t max_voters ) {
+      if( max_voters == 0 )
+         return 0;
+
+      const time_point week_start{ microseconds( ( block_timestamp::block_timestamp_epoch
+                                                   + weeks_since_epoch() * seconds_per_day * 7 * 1000ll ) * 1000 ) };
+      vote_ages_table vote_ages( _self, _self.value );
+      auto idx = vote_ages.get_index<"byupdate"_n>();
+      uint32_t count = 0;
+      for( auto itr = idx.begin(); itr != idx.end() && itr->last_vote_update < week_start && count < max_voters; ++count ) {
+         auto voter = _voters.find( itr->owner.value );
+         /// an empty proxy row may have been pruned while this voter had no weight to delegate to it
+         if( voter == _voters.end() || ( voter->proxy && _voters.find( voter->proxy.value ) == _voters.end() ) ) {
+            itr = idx.erase( itr );
+            continue;
          }
-      );
+         propagate_weight_change( *voter );
+         itr = idx.begin();
+      }
+      return count;
+   }
+
+   /**
+    *  Adds delta to the weight delegated to a proxy and queues the change of the proxy's own vote. The row of
+    *  a former proxy is erased once its stake is gone; there is nothing to update then.
+    */
+   void system_contract::adjust_proxied_weight( const name proxy, int128_t delta ) {
+      if( delta == 0 )
+         return;
+
+      auto pitr = _voters.find( proxy.value );
+      if( pitr == _voters.end() )
+         return;
+
+      rebase_voter( *pitr );
+      _voters.modify( pitr, same_payer, [&]( auto& p ) {
+            p.set_proxied_units( p.proxied_units() + delta );
+         });
+      queue_weight_change( *pitr );
+   }
+
+   /**
+    *  Marks a proxy as having pending weight changes. Many changes to the proxied weight of the
+    *  same proxy are coalesced into a single update of its producers when the queue is flushed.
+    */
+   void system_contract::queue_weight_change( const voter_info& proxy ) {
+      dirty_proxies_table dirty( _self, _self.value );
+      if( dirty.find( proxy.owner.value ) == dirty.end() ) {
+         dirty.emplace( _self, [&]( auto& d ) {
+               d.owner = proxy.owner;
+            });
+      }
+   }
+
+   uint32_t system_contract::flush_dirty_proxies( uint32_t max_proxies ) {
+      dirty_proxies_table dirty( _self, _self.value );
+      uint32_t count = 0;
+      for( auto itr = dirty.begin(); itr != dirty.end() && count < max_proxies; ++count ) {
+         auto pitr = _voters.find( itr->owner.value );
+         if( pitr != _voters.end() ) {
+            propagate_weight_change( *pitr );
+         }
+         itr = dirty.erase( itr );
+      }
+      return count;
+   }
+
+   void system_contract::flushproxies( uint16_t max_proxies ) {
+      eosio_assert( max_proxies > 0, "max_proxies must be positive" );
+      flush_dirty_proxies( max_proxies );
    }
 
 } /// namespace eosiosystem
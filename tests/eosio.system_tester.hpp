@@ -8,6 +8,8 @@
 #include <eosio/chain/abi_serializer.hpp>
 #include "contracts.hpp"
 #include "test_symbol.hpp"
+#include <eosio.system/vote_weight.hpp>
+#include <eosio.system/producer_ids.hpp>
 
 #include <fc/variant_object.hpp>
 #include <fstream>
@@ -312,6 +314,12 @@ public:
       return unstake( acnt, acnt, net, cpu );
    }
 
+   action_result flushproxies( uint16_t max_proxies = 100 ) {
+      return push_action( N(alice1111111), N(flushproxies), mvo()
+                          ("max_proxies", max_proxies)
+      );
+   }
+
    action_result bidname( const account_name& bidder, const account_name& newname, const asset& bid ) {
       return push_action( name(bidder), N(bidname), mvo()
                           ("bidder",  bidder)
@@ -380,14 +388,43 @@ public:
       return data.empty() ? fc::variant() : abi_ser.binary_to_variant( "voter_info", data, abi_serializer_max_time );
    }
 
+   /// the producers a voter votes for, whether its row lists them by name or, from version 1, by id
+   vector<account_name> get_voter_producers( const account_name& act ) {
+      auto info = get_voter_info( act );
+      if( !info.get_object().contains( "version" ) )
+         return info["producers"].as<vector<account_name>>();
+      vector<account_name> producers;
+      for( const auto id : eosiosystem::decode_producer_ids( info["producer_ids"].as<vector<char>>() ) ) {
+         vector<char> data = get_row_by_account( config::system_account_name, config::system_account_name, N(producerids), id );
+         BOOST_REQUIRE( !data.empty() );
+         producers.push_back( abi_ser.binary_to_variant( "producer_id_info", data, abi_serializer_max_time )["owner"].as<account_name>() );
+      }
+      std::sort( producers.begin(), producers.end() );
+      return producers;
+   }
+
    fc::variant get_producer_info( const account_name& act ) {
       vector<char> data = get_row_by_account( config::system_account_name, config::system_account_name, N(producers), act );
       return abi_ser.binary_to_variant( "producer_info", data, abi_serializer_max_time );
    }
 
+   /// the producers row with the unpaid blocks of the current round, which are counted in global5 until the next election
+   fc::variant get_current_producer_info( const account_name& act ) {
+      auto info = fc::mutable_variant_object( get_producer_info( act ).get_object() );
+      auto hot_state = get_global_state5();
+      if( !hot_state.is_null() ) {
+         for( const auto& r : hot_state["round_blocks"].get_array() ) {
+            if( r["producer"].as<account_name>() == act )
+               info["unpaid_blocks"] = info["unpaid_blocks"].as<uint32_t>() + r["unpaid_blocks"].as<uint32_t>();
+         }
+      }
+      return info;
+   }
+
+   /// the legacy producers2 row of a producer, votepay state is otherwise stored in the producers row
    fc::variant get_producer_info2( const account_name& act ) {
       vector<char> data = get_row_by_account( config::system_account_name, config::system_account_name, N(producers2), act );
-      return abi_ser.binary_to_variant( "producer_info2", data, abi_serializer_max_time );
+      return data.empty() ? fc::variant() : abi_ser.binary_to_variant( "producer_info2", data, abi_serializer_max_time );
    }
 
    void create_currency( name contract, name manager, asset maxsupply ) {
@@ -416,7 +453,12 @@ public:
 
    double stake2votes( asset stake ) {
       auto now = control->pending_block_time().time_since_epoch().count() / 1000000;
-      return stake.get_amount() * pow(2, int64_t((now - (config::block_timestamp_epoch / 1000)) / (86400 * 7))/ double(52) ); // 52 week periods (i.e. ~years)
+      // vote weights are relative to the start of the current vote epoch
+      const auto gstate4 = get_global_state4();
+      const int64_t vote_epoch = gstate4.is_null() ? 0 : gstate4["vote_epoch"].as<int64_t>();
+      const double weight = stake.get_amount() * pow(2, (int64_t((now - (config::block_timestamp_epoch / 1000)) / (86400 * 7)) - 52 * vote_epoch) / double(52) ); // 52 week periods (i.e. ~years)
+      // and kept in whole vote units
+      return eosiosystem::from_vote_units( eosiosystem::to_vote_units( weight ) );
    }
 
    double stake2votes( const string& s ) {
@@ -444,6 +486,26 @@ public:
       return data.empty() ? fc::variant() : abi_ser.binary_to_variant( "eosio_global_state", data, abi_serializer_max_time );
    }
 
+   /// the global state with the fields that are only copied to global on elections made current: the per block
+   /// counters from global5 and the vote total from global4
+   fc::variant get_current_global_state() {
+      auto state = get_global_state();
+      if( state.is_null() )
+         return state;
+      auto current = fc::mutable_variant_object( state.get_object() );
+      auto hot_state = get_global_state5();
+      if( !hot_state.is_null() ) {
+         current["last_producer_schedule_update"] = hot_state["last_producer_schedule_update"];
+         current["total_unpaid_blocks"]           = hot_state["total_unpaid_blocks"];
+      }
+      auto state4 = get_global_state4();
+      if( !state4.is_null() ) {
+         // an int128 is rendered as a decimal string, which parses to the same double the contract converts it to
+         current["total_producer_vote_weight"] = std::ldexp( state4["total_producer_vote_units"].as_double(), -eosiosystem::vote_unit_bits );
+      }
+      return current;
+   }
+
    fc::variant get_global_state2() {
       vector<char> data = get_row_by_account( config::system_account_name, config::system_account_name, N(global2), N(global2) );
       return data.empty() ? fc::variant() : abi_ser.binary_to_variant( "eosio_global_state2", data, abi_serializer_max_time );
@@ -454,6 +516,16 @@ public:
       return data.empty() ? fc::variant() : abi_ser.binary_to_variant( "eosio_global_state3", data, abi_serializer_max_time );
    }
 
+   fc::variant get_global_state4() {
+      vector<char> data = get_row_by_account( config::system_account_name, config::system_account_name, N(global4), N(global4) );
+      return data.empty() ? fc::variant() : abi_ser.binary_to_variant( "eosio_global_state4", data, abi_serializer_max_time );
+   }
+
+   fc::variant get_global_state5() {
+      vector<char> data = get_row_by_account( config::system_account_name, config::system_account_name, N(global5), N(global5) );
+      return data.empty() ? fc::variant() : abi_ser.binary_to_variant( "eosio_global_state5", data, abi_serializer_max_time );
+   }
+
    fc::variant get_refund_request( name account ) {
       vector<char> data = get_row_by_account( config::system_account_name, account, N(refunds), account );
       return data.empty() ? fc::variant() : abi_ser.binary_to_variant( "refund_request", data, abi_serializer_max_time );
@@ -1,4 +1,5 @@
 #include <boost/test/unit_test.hpp>
+#include <boost/multiprecision/cpp_bin_float.hpp>
 #include <eosio/chain/contract_table_objects.hpp>
 #include <eosio/chain/global_property_object.hpp>
 #include <eosio/chain/resource_limits.hpp>
@@ -11,6 +12,7 @@
 #include <Runtime/Runtime.h>
 
 #include "eosio.system_tester.hpp"
+#include <eosio.system/vote_weight.hpp>
 struct _abi_hash {
    name owner;
    fc::sha256 hash;
@@ -181,7 +183,8 @@ BOOST_FIXTURE_TEST_CASE( stake_unstake, eosio_system_tester ) try {
    produce_block( fc::hours(1) );
    produce_blocks(1);
 
-   REQUIRE_MATCHING_OBJECT( voter( "alice1111111", core_sym::from_string("0.0000") ), get_voter_info( "alice1111111" ) );
+   //the voter row is erased once nothing is staked
+   BOOST_REQUIRE_EQUAL( true, get_voter_info( "alice1111111" ).is_null() );
    produce_blocks(1);
    BOOST_REQUIRE_EQUAL( core_sym::from_string("1000.0000"), get_balance( "alice1111111" ) );
 } FC_LOG_AND_RETHROW()
@@ -234,13 +237,90 @@ BOOST_FIXTURE_TEST_CASE( stake_unstake_with_transfer, eosio_system_tester ) try
    total = get_total_stake("alice1111111");
    BOOST_REQUIRE_EQUAL( core_sym::from_string("10.0000"), total["net_weight"].as<asset>());
    BOOST_REQUIRE_EQUAL( core_sym::from_string("10.0000"), total["cpu_weight"].as<asset>());
-   REQUIRE_MATCHING_OBJECT( voter( "alice1111111", core_sym::from_string("0.0000")), get_voter_info( "alice1111111" ) );
+   BOOST_REQUIRE_EQUAL( true, get_voter_info( "alice1111111" ).is_null() );
 
    // Now alice stakes to bob with transfer flag
    BOOST_REQUIRE_EQUAL( success(), stake_with_transfer( "alice1111111", "bob111111111", core_sym::from_string("100.0000"), core_sym::from_string("100.0000") ) );
 
 } FC_LOG_AND_RETHROW()
 
+BOOST_FIXTURE_TEST_CASE( prunevoters_keeps_used_rows, eosio_system_tester ) try {
+   cross_15_percent_threshold();
+
+   issue( "alice1111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   BOOST_REQUIRE_EQUAL( success(), stake( "alice1111111", core_sym::from_string("200.0000"), core_sym::from_string("100.0000") ) );
+   BOOST_REQUIRE_EQUAL( success(), push_action( N(bob111111111), N(regproxy), mvo()("proxy", "bob111111111")("isproxy", true) ) );
+
+   BOOST_REQUIRE_EQUAL( error("missing authority of eosio"),
+                        push_action( N(alice1111111), N(prunevoters), mvo()("lower_bound", "")("max_rows", 100) ) );
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg( "max_rows must be positive" ),
+                        push_action( config::system_account_name, N(prunevoters), mvo()("lower_bound", "")("max_rows", 0) ) );
+   BOOST_REQUIRE_EQUAL( success(),
+                        push_action( config::system_account_name, N(prunevoters), mvo()("lower_bound", "")("max_rows", 100) ) );
+
+   //rows with a stake or a proxy registration are kept
+   REQUIRE_MATCHING_OBJECT( voter( "alice1111111", core_sym::from_string("300.0000") ), get_voter_info( "alice1111111" ) );
+   REQUIRE_MATCHING_OBJECT( proxy( "bob111111111" ), get_voter_info( "bob111111111" ) );
+
+   //a full unstake erases the row of a voter that does not vote
+   BOOST_REQUIRE_EQUAL( success(), unstake( "alice1111111", core_sym::from_string("200.0000"), core_sym::from_string("100.0000") ) );
+   BOOST_REQUIRE_EQUAL( true, get_voter_info( "alice1111111" ).is_null() );
+
+} FC_LOG_AND_RETHROW()
+
+BOOST_FIXTURE_TEST_CASE( full_unstake_keeps_rows_of_voters, eosio_system_tester ) try {
+   cross_15_percent_threshold();
+
+   issue( "alice1111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( N(carol1111111) ) );
+   BOOST_REQUIRE_EQUAL( success(), stake( "alice1111111", core_sym::from_string("200.0000"), core_sym::from_string("100.0000") ) );
+   const int64_t activated_stake = get_global_state()["total_activated_stake"].as<int64_t>();
+
+   //the first vote activates the stake of alice
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), { N(carol1111111) } ) );
+   const int64_t voted_stake = activated_stake + core_sym::from_string("300.0000").get_amount();
+   BOOST_REQUIRE_EQUAL( voted_stake, get_global_state()["total_activated_stake"].as<int64_t>() );
+
+   //without votes and stake the row still records that alice has voted
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), vector<account_name>() ) );
+   BOOST_REQUIRE_EQUAL( success(), unstake( "alice1111111", core_sym::from_string("200.0000"), core_sym::from_string("100.0000") ) );
+   BOOST_REQUIRE_EQUAL( false, get_voter_info( "alice1111111" ).is_null() );
+   BOOST_REQUIRE_EQUAL( success(),
+                        push_action( config::system_account_name, N(prunevoters), mvo()("lower_bound", "")("max_rows", 100) ) );
+   BOOST_REQUIRE_EQUAL( false, get_voter_info( "alice1111111" ).is_null() );
+
+   //so voting again does not activate the same stake a second time
+   BOOST_REQUIRE_EQUAL( success(), stake( "alice1111111", core_sym::from_string("200.0000"), core_sym::from_string("100.0000") ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), { N(carol1111111) } ) );
+   BOOST_REQUIRE_EQUAL( voted_stake, get_global_state()["total_activated_stake"].as<int64_t>() );
+
+} FC_LOG_AND_RETHROW()
+
+BOOST_FIXTURE_TEST_CASE( vote_after_proxy_row_erased, eosio_system_tester, * boost::unit_test::tolerance(1e-10) ) try {
+   cross_15_percent_threshold();
+
+   issue( "alice1111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   issue( "bob111111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( N(carol1111111) ) );
+   BOOST_REQUIRE_EQUAL( success(), push_action( N(bob111111111), N(regproxy), mvo()("proxy", "bob111111111")("isproxy", true) ) );
+   BOOST_REQUIRE_EQUAL( success(), stake( "bob111111111", core_sym::from_string("10.0000"), core_sym::from_string("10.0000") ) );
+   BOOST_REQUIRE_EQUAL( success(), stake( "alice1111111", core_sym::from_string("100.0000"), core_sym::from_string("50.0000") ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), vector<account_name>(), N(bob111111111) ) );
+
+   //alice leaves no weight with bob, so bob's row is erased after unregistering and unstaking
+   BOOST_REQUIRE_EQUAL( success(), unstake( "alice1111111", core_sym::from_string("100.0000"), core_sym::from_string("50.0000") ) );
+   BOOST_REQUIRE_EQUAL( success(), push_action( N(bob111111111), N(regproxy), mvo()("proxy", "bob111111111")("isproxy", false) ) );
+   BOOST_REQUIRE_EQUAL( success(), unstake( "bob111111111", core_sym::from_string("10.0000"), core_sym::from_string("10.0000") ) );
+   BOOST_REQUIRE_EQUAL( true, get_voter_info( "bob111111111" ).is_null() );
+
+   //alice still names bob as her proxy, her new weight has no proxy row to be taken from
+   BOOST_REQUIRE_EQUAL( success(), stake( "alice1111111", core_sym::from_string("100.0000"), core_sym::from_string("50.0000") ) );
+   BOOST_REQUIRE_EQUAL( success(), push_action( N(alice1111111), N(refreshvotes), mvo()("voters", vector<account_name>{ N(alice1111111) }) ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), { N(carol1111111) } ) );
+   BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("150.0000")) == get_producer_info( "carol1111111" )["total_votes"].as_double() );
+
+} FC_LOG_AND_RETHROW()
+
 BOOST_FIXTURE_TEST_CASE( stake_to_self_with_transfer, eosio_system_tester ) try {
    cross_15_percent_threshold();
 
@@ -301,7 +381,7 @@ BOOST_FIXTURE_TEST_CASE( stake_while_pending_refund, eosio_system_tester ) try {
    total = get_total_stake("alice1111111");
    BOOST_REQUIRE_EQUAL( core_sym::from_string("10.0000"), total["net_weight"].as<asset>());
    BOOST_REQUIRE_EQUAL( core_sym::from_string("10.0000"), total["cpu_weight"].as<asset>());
-   REQUIRE_MATCHING_OBJECT( voter( "alice1111111", core_sym::from_string("0.0000")), get_voter_info( "alice1111111" ) );
+   BOOST_REQUIRE_EQUAL( true, get_voter_info( "alice1111111" ).is_null() );
 
    // Now alice stakes to bob with transfer flag
    BOOST_REQUIRE_EQUAL( success(), stake_with_transfer( "alice1111111", "bob111111111", core_sym::from_string("100.0000"), core_sym::from_string("100.0000") ) );
@@ -1034,6 +1114,19 @@ BOOST_FIXTURE_TEST_CASE( vote_for_two_producers, eosio_system_tester, * boost::u
 } FC_LOG_AND_RETHROW()
 
 
+BOOST_AUTO_TEST_CASE( vote_weight_table_matches_pow ) try {
+   // every multiplier must be pow(2, weeks / 52.0) correctly rounded, so the table gives the same vote weights
+   // as the formula it replaces wherever that pow is correctly rounded; it is not checked against the host pow
+   using boost::multiprecision::cpp_bin_float_100;
+   for( int64_t weeks = 0; weeks < eosiosystem::vote_weight_table_weeks; ++weeks ) {
+      const cpp_bin_float_100 exponent( weeks / double( 52 ) );
+      const double expected = exp( log( cpp_bin_float_100( 2 ) ) * exponent ).convert_to<double>();
+      BOOST_REQUIRE_EQUAL( expected, eosiosystem::vote_weight_multiplier( weeks ) );
+   }
+   BOOST_REQUIRE_EQUAL( 1.0, eosiosystem::vote_weight_table[0] );
+   BOOST_REQUIRE_EQUAL( 2.0, eosiosystem::vote_weight_table[52] );
+} FC_LOG_AND_RETHROW()
+
 BOOST_FIXTURE_TEST_CASE( proxy_register_unregister_keeps_stake, eosio_system_tester ) try {
    //register proxy by first action for this user ever
    BOOST_REQUIRE_EQUAL( success(), push_action(N(alice1111111), N(regproxy), mvo()
@@ -1161,6 +1254,7 @@ BOOST_FIXTURE_TEST_CASE( proxy_actions_affect_producers, eosio_system_tester, *
                                                 ("isproxy", false)
                         )
    );
+   produce_block(); // onblock applies the queued proxy weight changes
    //REQUIRE_MATCHING_OBJECT( voter( "alice1111111" )( "proxied_vote_weight", stake2votes(core_sym::from_string("150.0003")) ), get_voter_info( "alice1111111" ) );
    BOOST_REQUIRE_EQUAL( 0, get_producer_info( "defproducer1" )["total_votes"].as_double() );
    BOOST_REQUIRE_EQUAL( 0, get_producer_info( "defproducer2" )["total_votes"].as_double() );
@@ -1172,6 +1266,7 @@ BOOST_FIXTURE_TEST_CASE( proxy_actions_affect_producers, eosio_system_tester, *
                                                 ("isproxy", true)
                         )
    );
+   produce_block();
    BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("150.0003")) == get_producer_info( "defproducer1" )["total_votes"].as_double() );
    BOOST_REQUIRE_EQUAL( 0, get_producer_info( "defproducer2" )["total_votes"].as_double() );
    BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("150.0003")) == get_producer_info( "defproducer3" )["total_votes"].as_double() );
@@ -1179,9 +1274,9 @@ BOOST_FIXTURE_TEST_CASE( proxy_actions_affect_producers, eosio_system_tester, *
    //stake increase by proxy itself affects producers
    issue( "alice1111111", core_sym::from_string("1000.0000"),  config::system_account_name );
    BOOST_REQUIRE_EQUAL( success(), stake( "alice1111111", core_sym::from_string("30.0001"), core_sym::from_string("20.0001") ) );
-   BOOST_REQUIRE_EQUAL( stake2votes(core_sym::from_string("200.0005")), get_producer_info( "defproducer1" )["total_votes"].as_double() );
+   BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("200.0005")) == get_producer_info( "defproducer1" )["total_votes"].as_double() );
    BOOST_REQUIRE_EQUAL( 0, get_producer_info( "defproducer2" )["total_votes"].as_double() );
-   BOOST_REQUIRE_EQUAL( stake2votes(core_sym::from_string("200.0005")), get_producer_info( "defproducer3" )["total_votes"].as_double() );
+   BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("200.0005")) == get_producer_info( "defproducer3" )["total_votes"].as_double() );
 
    //stake decrease by proxy itself affects producers
    BOOST_REQUIRE_EQUAL( success(), unstake( "alice1111111", core_sym::from_string("10.0001"), core_sym::from_string("10.0001") ) );
@@ -1220,14 +1315,14 @@ BOOST_FIXTURE_TEST_CASE(producer_pay, eosio_system_tester, * boost::unit_test::t
    {
       produce_blocks(50);
 
-      const auto     initial_global_state      = get_global_state();
+      const auto     initial_global_state      = get_current_global_state();
       const uint64_t initial_claim_time        = microseconds_since_epoch_of_iso_string( initial_global_state["last_pervote_bucket_fill"] );
       const int64_t  initial_pervote_bucket    = initial_global_state["pervote_bucket"].as<int64_t>();
       const int64_t  initial_perblock_bucket   = initial_global_state["perblock_bucket"].as<int64_t>();
       const int64_t  initial_savings           = get_balance(N(eosio.saving)).get_amount();
       const uint32_t initial_tot_unpaid_blocks = initial_global_state["total_unpaid_blocks"].as<uint32_t>();
 
-      prod = get_producer_info("defproducera");
+      prod = get_current_producer_info("defproducera");
       const uint32_t unpaid_blocks = prod["unpaid_blocks"].as<uint32_t>();
       BOOST_REQUIRE(1 < unpaid_blocks);
 
@@ -1238,14 +1333,14 @@ BOOST_FIXTURE_TEST_CASE(producer_pay, eosio_system_tester, * boost::unit_test::t
 
       BOOST_REQUIRE_EQUAL(success(), push_action(N(defproducera), N(claimrewards), mvo()("owner", "defproducera")));
 
-      const auto     global_state      = get_global_state();
+      const auto     global_state      = get_current_global_state();
       const uint64_t claim_time        = microseconds_since_epoch_of_iso_string( global_state["last_pervote_bucket_fill"] );
       const int64_t  pervote_bucket    = global_state["pervote_bucket"].as<int64_t>();
       const int64_t  perblock_bucket   = global_state["perblock_bucket"].as<int64_t>();
       const int64_t  savings           = get_balance(N(eosio.saving)).get_amount();
       const uint32_t tot_unpaid_blocks = global_state["total_unpaid_blocks"].as<uint32_t>();
 
-      prod = get_producer_info("defproducera");
+      prod = get_current_producer_info("defproducera");
       BOOST_REQUIRE_EQUAL(1, prod["unpaid_blocks"].as<uint32_t>());
       BOOST_REQUIRE_EQUAL(1, tot_unpaid_blocks);
       const asset supply  = get_token_supply();
@@ -1296,7 +1391,7 @@ BOOST_FIXTURE_TEST_CASE(producer_pay, eosio_system_tester, * boost::unit_test::t
    {
       produce_block(fc::seconds(5 * 60));
 
-      const auto     initial_global_state      = get_global_state();
+      const auto     initial_global_state      = get_current_global_state();
       const uint64_t initial_claim_time        = microseconds_since_epoch_of_iso_string( initial_global_state["last_pervote_bucket_fill"] );
       const int64_t  initial_pervote_bucket    = initial_global_state["pervote_bucket"].as<int64_t>();
       const int64_t  initial_perblock_bucket   = initial_global_state["perblock_bucket"].as<int64_t>();
@@ -1304,7 +1399,7 @@ BOOST_FIXTURE_TEST_CASE(producer_pay, eosio_system_tester, * boost::unit_test::t
       const uint32_t initial_tot_unpaid_blocks = initial_global_state["total_unpaid_blocks"].as<uint32_t>();
       const double   initial_tot_vote_weight   = initial_global_state["total_producer_vote_weight"].as<double>();
 
-      prod = get_producer_info("defproducera");
+      prod = get_current_producer_info("defproducera");
       const uint32_t unpaid_blocks = prod["unpaid_blocks"].as<uint32_t>();
       BOOST_REQUIRE(1 < unpaid_blocks);
       BOOST_REQUIRE_EQUAL(initial_tot_unpaid_blocks, unpaid_blocks);
@@ -1319,14 +1414,14 @@ BOOST_FIXTURE_TEST_CASE(producer_pay, eosio_system_tester, * boost::unit_test::t
 
       BOOST_REQUIRE_EQUAL(success(), push_action(N(defproducera), N(claimrewards), mvo()("owner", "defproducera")));
 
-      const auto global_state          = get_global_state();
+      const auto global_state          = get_current_global_state();
       const uint64_t claim_time        = microseconds_since_epoch_of_iso_string( global_state["last_pervote_bucket_fill"] );
       const int64_t  pervote_bucket    = global_state["pervote_bucket"].as<int64_t>();
       const int64_t  perblock_bucket   = global_state["perblock_bucket"].as<int64_t>();
       const int64_t  savings           = get_balance(N(eosio.saving)).get_amount();
       const uint32_t tot_unpaid_blocks = global_state["total_unpaid_blocks"].as<uint32_t>();
 
-      prod = get_producer_info("defproducera");
+      prod = get_current_producer_info("defproducera");
       BOOST_REQUIRE_EQUAL(1, prod["unpaid_blocks"].as<uint32_t>());
       BOOST_REQUIRE_EQUAL(1, tot_unpaid_blocks);
       const asset supply  = get_token_supply();
@@ -1441,12 +1536,12 @@ BOOST_FIXTURE_TEST_CASE(multiple_producer_pay, eosio_system_tester, * boost::uni
    }
 
    {
-      auto proda = get_producer_info( N(defproducera) );
+      auto proda = get_current_producer_info( N(defproducera) );
       auto prodj = get_producer_info( N(defproducerj) );
       auto prodk = get_producer_info( N(defproducerk) );
       auto produ = get_producer_info( N(defproduceru) );
       auto prodv = get_producer_info( N(defproducerv) );
-      auto prodz = get_producer_info( N(defproducerz) );
+      auto prodz = get_current_producer_info( N(defproducerz) );
 
       BOOST_REQUIRE (0 == proda["unpaid_blocks"].as<uint32_t>() && 0 == prodz["unpaid_blocks"].as<uint32_t>());
 
@@ -1464,13 +1559,13 @@ BOOST_FIXTURE_TEST_CASE(multiple_producer_pay, eosio_system_tester, * boost::uni
       produce_blocks(23 * 12 + 20);
       bool all_21_produced = true;
       for (uint32_t i = 0; i < 21; ++i) {
-         if (0 == get_producer_info(producer_names[i])["unpaid_blocks"].as<uint32_t>()) {
+         if (0 == get_current_producer_info(producer_names[i])["unpaid_blocks"].as<uint32_t>()) {
             all_21_produced = false;
          }
       }
       bool rest_didnt_produce = true;
       for (uint32_t i = 21; i < producer_names.size(); ++i) {
-         if (0 < get_producer_info(producer_names[i])["unpaid_blocks"].as<uint32_t>()) {
+         if (0 < get_current_producer_info(producer_names[i])["unpaid_blocks"].as<uint32_t>()) {
             rest_didnt_produce = false;
          }
       }
@@ -1484,7 +1579,7 @@ BOOST_FIXTURE_TEST_CASE(multiple_producer_pay, eosio_system_tester, * boost::uni
          vote_shares[i] = get_producer_info(producer_names[i])["total_votes"].as<double>();
          total_votes += vote_shares[i];
       }
-      BOOST_TEST(total_votes == get_global_state()["total_producer_vote_weight"].as<double>());
+      BOOST_TEST(total_votes == get_current_global_state()["total_producer_vote_weight"].as<double>());
       std::for_each(vote_shares.begin(), vote_shares.end(), [total_votes](double& x) { x /= total_votes; });
 
       BOOST_TEST(double(1) == std::accumulate(vote_shares.begin(), vote_shares.end(), double(0)));
@@ -1496,7 +1591,7 @@ BOOST_FIXTURE_TEST_CASE(multiple_producer_pay, eosio_system_tester, * boost::uni
       const uint32_t prod_index = 2;
       const auto prod_name = producer_names[prod_index];
 
-      const auto     initial_global_state      = get_global_state();
+      const auto     initial_global_state      = get_current_global_state();
       const uint64_t initial_claim_time        = microseconds_since_epoch_of_iso_string( initial_global_state["last_pervote_bucket_fill"] );
       const int64_t  initial_pervote_bucket    = initial_global_state["pervote_bucket"].as<int64_t>();
       const int64_t  initial_perblock_bucket   = initial_global_state["perblock_bucket"].as<int64_t>();
@@ -1506,11 +1601,11 @@ BOOST_FIXTURE_TEST_CASE(multiple_producer_pay, eosio_system_tester, * boost::uni
       const asset    initial_bpay_balance      = get_balance(N(eosio.bpay));
       const asset    initial_vpay_balance      = get_balance(N(eosio.vpay));
       const asset    initial_balance           = get_balance(prod_name);
-      const uint32_t initial_unpaid_blocks     = get_producer_info(prod_name)["unpaid_blocks"].as<uint32_t>();
+      const uint32_t initial_unpaid_blocks     = get_current_producer_info(prod_name)["unpaid_blocks"].as<uint32_t>();
 
       BOOST_REQUIRE_EQUAL(success(), push_action(prod_name, N(claimrewards), mvo()("owner", prod_name)));
 
-      const auto     global_state      = get_global_state();
+      const auto     global_state      = get_current_global_state();
       const uint64_t claim_time        = microseconds_since_epoch_of_iso_string( global_state["last_pervote_bucket_fill"] );
       const int64_t  pervote_bucket    = global_state["pervote_bucket"].as<int64_t>();
       const int64_t  perblock_bucket   = global_state["perblock_bucket"].as<int64_t>();
@@ -1520,7 +1615,7 @@ BOOST_FIXTURE_TEST_CASE(multiple_producer_pay, eosio_system_tester, * boost::uni
       const asset    bpay_balance      = get_balance(N(eosio.bpay));
       const asset    vpay_balance      = get_balance(N(eosio.vpay));
       const asset    balance           = get_balance(prod_name);
-      const uint32_t unpaid_blocks     = get_producer_info(prod_name)["unpaid_blocks"].as<uint32_t>();
+      const uint32_t unpaid_blocks     = get_current_producer_info(prod_name)["unpaid_blocks"].as<uint32_t>();
 
       const uint64_t usecs_between_fills = claim_time - initial_claim_time;
       const int32_t secs_between_fills = static_cast<int32_t>(usecs_between_fills / 1000000);
@@ -1572,7 +1667,7 @@ BOOST_FIXTURE_TEST_CASE(multiple_producer_pay, eosio_system_tester, * boost::uni
       const uint32_t prod_index = 15;
       const auto prod_name = producer_names[prod_index];
 
-      const auto     initial_global_state      = get_global_state();
+      const auto     initial_global_state      = get_current_global_state();
       const uint64_t initial_claim_time        = microseconds_since_epoch_of_iso_string( initial_global_state["last_pervote_bucket_fill"] );
       const int64_t  initial_pervote_bucket    = initial_global_state["pervote_bucket"].as<int64_t>();
       const int64_t  initial_perblock_bucket   = initial_global_state["perblock_bucket"].as<int64_t>();
@@ -1582,11 +1677,11 @@ BOOST_FIXTURE_TEST_CASE(multiple_producer_pay, eosio_system_tester, * boost::uni
       const asset    initial_bpay_balance      = get_balance(N(eosio.bpay));
       const asset    initial_vpay_balance      = get_balance(N(eosio.vpay));
       const asset    initial_balance           = get_balance(prod_name);
-      const uint32_t initial_unpaid_blocks     = get_producer_info(prod_name)["unpaid_blocks"].as<uint32_t>();
+      const uint32_t initial_unpaid_blocks     = get_current_producer_info(prod_name)["unpaid_blocks"].as<uint32_t>();
 
       BOOST_REQUIRE_EQUAL(success(), push_action(prod_name, N(claimrewards), mvo()("owner", prod_name)));
 
-      const auto     global_state      = get_global_state();
+      const auto     global_state      = get_current_global_state();
       const uint64_t claim_time        = microseconds_since_epoch_of_iso_string( global_state["last_pervote_bucket_fill"] );
       const int64_t  pervote_bucket    = global_state["pervote_bucket"].as<int64_t>();
       const int64_t  perblock_bucket   = global_state["perblock_bucket"].as<int64_t>();
@@ -1596,7 +1691,7 @@ BOOST_FIXTURE_TEST_CASE(multiple_producer_pay, eosio_system_tester, * boost::uni
       const asset    bpay_balance      = get_balance(N(eosio.bpay));
       const asset    vpay_balance      = get_balance(N(eosio.vpay));
       const asset    balance           = get_balance(prod_name);
-      const uint32_t unpaid_blocks     = get_producer_info(prod_name)["unpaid_blocks"].as<uint32_t>();
+      const uint32_t unpaid_blocks     = get_current_producer_info(prod_name)["unpaid_blocks"].as<uint32_t>();
 
       const uint64_t usecs_between_fills = claim_time - initial_claim_time;
 
@@ -1656,7 +1751,7 @@ BOOST_FIXTURE_TEST_CASE(multiple_producer_pay, eosio_system_tester, * boost::uni
       {
          bool rest_didnt_produce = true;
          for (uint32_t i = 21; i < producer_names.size(); ++i) {
-            if (0 < get_producer_info(producer_names[i])["unpaid_blocks"].as<uint32_t>()) {
+            if (0 < get_current_producer_info(producer_names[i])["unpaid_blocks"].as<uint32_t>()) {
                rest_didnt_produce = false;
             }
          }
@@ -1664,18 +1759,18 @@ BOOST_FIXTURE_TEST_CASE(multiple_producer_pay, eosio_system_tester, * boost::uni
       }
 
       produce_blocks(3 * 21 * 12);
-      info = get_producer_info(prod_name);
+      info = get_current_producer_info(prod_name);
       const uint32_t init_unpaid_blocks = info["unpaid_blocks"].as<uint32_t>();
       BOOST_REQUIRE( !info["is_active"].as<bool>() );
       BOOST_REQUIRE( fc::crypto::public_key() == fc::crypto::public_key(info["producer_key"].as_string()) );
       BOOST_REQUIRE_EQUAL( wasm_assert_msg("producer does not have an active key"),
                            push_action(prod_name, N(claimrewards), mvo()("owner", prod_name) ) );
       produce_blocks(3 * 21 * 12);
-      BOOST_REQUIRE_EQUAL( init_unpaid_blocks, get_producer_info(prod_name)["unpaid_blocks"].as<uint32_t>() );
+      BOOST_REQUIRE_EQUAL( init_unpaid_blocks, get_current_producer_info(prod_name)["unpaid_blocks"].as<uint32_t>() );
       {
          bool prod_was_replaced = false;
          for (uint32_t i = 21; i < producer_names.size(); ++i) {
-            if (0 < get_producer_info(producer_names[i])["unpaid_blocks"].as<uint32_t>()) {
+            if (0 < get_current_producer_info(producer_names[i])["unpaid_blocks"].as<uint32_t>()) {
                prod_was_replaced = true;
             }
          }
@@ -1702,9 +1797,9 @@ BOOST_FIXTURE_TEST_CASE(multiple_producer_pay, eosio_system_tester, * boost::uni
       const uint32_t prod_index = 2;
       const auto prod_name = producer_names[prod_index];
 
-      const auto     initial_prod_info         = get_producer_info(prod_name);
-      const auto     initial_prod_info2        = get_producer_info2(prod_name);
-      const auto     initial_global_state      = get_global_state();
+      const auto     initial_prod_info         = get_current_producer_info(prod_name);
+      const auto     initial_prod_info2        = get_producer_info(prod_name);
+      const auto     initial_global_state      = get_current_global_state();
       const double   initial_tot_votepay_share = get_global_state2()["total_producer_votepay_share"].as_double();
       const double   initial_tot_vpay_rate     = get_global_state3()["total_vpay_share_change_rate"].as_double();
       const uint64_t initial_vpay_state_update = microseconds_since_epoch_of_iso_string( get_global_state3()["last_vpay_state_update"] );
@@ -1718,12 +1813,12 @@ BOOST_FIXTURE_TEST_CASE(multiple_producer_pay, eosio_system_tester, * boost::uni
       const uint64_t initial_claim_time        = microseconds_since_epoch_of_iso_string( initial_prod_info["last_claim_time"] );
       const uint64_t initial_prod_update_time  = microseconds_since_epoch_of_iso_string( initial_prod_info2["last_votepay_share_update"] );
 
-      BOOST_TEST_REQUIRE( 0 == get_producer_info2(prod_name)["votepay_share"].as_double() );
+      BOOST_TEST_REQUIRE( 0 == get_producer_info(prod_name)["votepay_share"].as_double() );
       BOOST_REQUIRE_EQUAL( success(), push_action(prod_name, N(claimrewards), mvo()("owner", prod_name) ) );
 
-      const auto     prod_info         = get_producer_info(prod_name);
-      const auto     prod_info2        = get_producer_info2(prod_name);
-      const auto     global_state      = get_global_state();
+      const auto     prod_info         = get_current_producer_info(prod_name);
+      const auto     prod_info2        = get_producer_info(prod_name);
+      const auto     global_state      = get_current_global_state();
       const uint64_t vpay_state_update = microseconds_since_epoch_of_iso_string( get_global_state3()["last_vpay_state_update"] );
       const uint64_t bucket_fill_time  = microseconds_since_epoch_of_iso_string( global_state["last_pervote_bucket_fill"] );
       const int64_t  pervote_bucket    = global_state["pervote_bucket"].as<int64_t>();
@@ -1754,7 +1849,7 @@ BOOST_FIXTURE_TEST_CASE(multiple_producer_pay, eosio_system_tester, * boost::uni
       BOOST_REQUIRE( 100 * 10000 < from_pervote_bucket );
       BOOST_CHECK_EQUAL( expected_pervote_bucket - from_pervote_bucket, pervote_bucket );
       BOOST_CHECK_EQUAL( from_perblock_bucket + from_pervote_bucket, balance.get_amount() - initial_balance.get_amount() );
-      BOOST_TEST_REQUIRE( 0 == get_producer_info2(prod_name)["votepay_share"].as_double() );
+      BOOST_TEST_REQUIRE( 0 == get_producer_info(prod_name)["votepay_share"].as_double() );
 
       produce_block(fc::hours(2));
 
@@ -1799,8 +1894,8 @@ BOOST_FIXTURE_TEST_CASE(multiple_producer_votepay_share, eosio_system_tester, *
          ilog( "------ get pro----------" );
          wdump((p));
          BOOST_TEST_REQUIRE(0 == get_producer_info(p)["total_votes"].as_double());
-         BOOST_TEST_REQUIRE(0 == get_producer_info2(p)["votepay_share"].as_double());
-         BOOST_REQUIRE(0 < microseconds_since_epoch_of_iso_string( get_producer_info2(p)["last_votepay_share_update"] ));
+         BOOST_TEST_REQUIRE(0 == get_producer_info(p)["votepay_share"].as_double());
+         BOOST_REQUIRE(0 < microseconds_since_epoch_of_iso_string( get_producer_info(p)["last_votepay_share_update"] ));
       }
    }
 
@@ -1816,31 +1911,31 @@ BOOST_FIXTURE_TEST_CASE(multiple_producer_votepay_share, eosio_system_tester, *
       produce_block( fc::hours(10) );
       BOOST_TEST_REQUIRE( 0 == get_global_state2()["total_producer_votepay_share"].as_double() );
       const auto& init_info  = get_producer_info(producer_names[0]);
-      const auto& init_info2 = get_producer_info2(producer_names[0]);
+      const auto& init_info2 = get_producer_info(producer_names[0]);
       uint64_t init_update = microseconds_since_epoch_of_iso_string( init_info2["last_votepay_share_update"] );
       double   init_votes  = init_info["total_votes"].as_double();
       BOOST_REQUIRE_EQUAL( success(), vote(N(producvoterb), vector<account_name>(producer_names.begin(), producer_names.begin()+21)) );
       const auto& info  = get_producer_info(producer_names[0]);
-      const auto& info2 = get_producer_info2(producer_names[0]);
+      const auto& info2 = get_producer_info(producer_names[0]);
       BOOST_TEST_REQUIRE( ((microseconds_since_epoch_of_iso_string( info2["last_votepay_share_update"] ) - init_update)/double(1E6)) * init_votes == info2["votepay_share"].as_double() );
       BOOST_TEST_REQUIRE( info2["votepay_share"].as_double() * 10 == get_global_state2()["total_producer_votepay_share"].as_double() );
 
-      BOOST_TEST_REQUIRE( 0 == get_producer_info2(producer_names[11])["votepay_share"].as_double() );
+      BOOST_TEST_REQUIRE( 0 == get_producer_info(producer_names[11])["votepay_share"].as_double() );
       produce_block( fc::hours(13) );
       BOOST_REQUIRE_EQUAL( success(), vote(N(producvoterc), vector<account_name>(producer_names.begin(), producer_names.begin()+26)) );
-      BOOST_REQUIRE( 0 < get_producer_info2(producer_names[11])["votepay_share"].as_double() );
+      BOOST_REQUIRE( 0 < get_producer_info(producer_names[11])["votepay_share"].as_double() );
       produce_block( fc::hours(1) );
       BOOST_REQUIRE_EQUAL( success(), vote(N(producvoterd), vector<account_name>(producer_names.begin()+26, producer_names.end())) );
-      BOOST_TEST_REQUIRE( 0 == get_producer_info2(producer_names[26])["votepay_share"].as_double() );
+      BOOST_TEST_REQUIRE( 0 == get_producer_info(producer_names[26])["votepay_share"].as_double() );
    }
 
    {
-      auto proda = get_producer_info( N(defproducera) );
+      auto proda = get_current_producer_info( N(defproducera) );
       auto prodj = get_producer_info( N(defproducerj) );
       auto prodk = get_producer_info( N(defproducerk) );
       auto produ = get_producer_info( N(defproduceru) );
       auto prodv = get_producer_info( N(defproducerv) );
-      auto prodz = get_producer_info( N(defproducerz) );
+      auto prodz = get_current_producer_info( N(defproducerz) );
 
       BOOST_REQUIRE (0 == proda["unpaid_blocks"].as<uint32_t>() && 0 == prodz["unpaid_blocks"].as<uint32_t>());
 
@@ -1860,9 +1955,9 @@ BOOST_FIXTURE_TEST_CASE(multiple_producer_votepay_share, eosio_system_tester, *
          vote_shares[i] = get_producer_info(producer_names[i])["total_votes"].as_double();
          total_votes += vote_shares[i];
       }
-      BOOST_TEST_REQUIRE( total_votes == get_global_state()["total_producer_vote_weight"].as_double() );
+      BOOST_TEST_REQUIRE( total_votes == get_current_global_state()["total_producer_vote_weight"].as_double() );
       BOOST_TEST_REQUIRE( total_votes == get_global_state3()["total_vpay_share_change_rate"].as_double() );
-      BOOST_REQUIRE_EQUAL( microseconds_since_epoch_of_iso_string( get_producer_info2(producer_names.back())["last_votepay_share_update"] ),
+      BOOST_REQUIRE_EQUAL( microseconds_since_epoch_of_iso_string( get_producer_info(producer_names.back())["last_votepay_share_update"] ),
                            microseconds_since_epoch_of_iso_string( get_global_state3()["last_vpay_state_update"] ) );
 
       std::for_each( vote_shares.begin(), vote_shares.end(), [total_votes](double& x) { x /= total_votes; } );
@@ -1878,7 +1973,7 @@ BOOST_FIXTURE_TEST_CASE(multiple_producer_votepay_share, eosio_system_tester, *
       double expected_total_votepay_shares = 0;
       for (uint32_t i = 0; i < producer_names.size() ; ++i) {
          const auto& info  = get_producer_info(producer_names[i]);
-         const auto& info2 = get_producer_info2(producer_names[i]);
+         const auto& info2 = get_producer_info(producer_names[i]);
          votepay_shares[i] = info2["votepay_share"].as_double();
          total_votepay_shares          += votepay_shares[i];
          expected_total_votepay_shares += votepay_shares[i];
@@ -1895,22 +1990,22 @@ BOOST_FIXTURE_TEST_CASE(multiple_producer_votepay_share, eosio_system_tester, *
       const uint32_t prod_index = 15;
       const account_name prod_name = producer_names[prod_index];
       const auto& init_info        = get_producer_info(prod_name);
-      const auto& init_info2       = get_producer_info2(prod_name);
+      const auto& init_info2       = get_producer_info(prod_name);
       BOOST_REQUIRE( 0 < init_info2["votepay_share"].as_double() );
       BOOST_REQUIRE( 0 < microseconds_since_epoch_of_iso_string( init_info2["last_votepay_share_update"] ) );
 
       BOOST_REQUIRE_EQUAL( success(), push_action(prod_name, N(claimrewards), mvo()("owner", prod_name)) );
 
-      BOOST_TEST_REQUIRE( 0 == get_producer_info2(prod_name)["votepay_share"].as_double() );
+      BOOST_TEST_REQUIRE( 0 == get_producer_info(prod_name)["votepay_share"].as_double() );
       BOOST_REQUIRE_EQUAL( get_producer_info(prod_name)["last_claim_time"].as_string(),
-                           get_producer_info2(prod_name)["last_votepay_share_update"].as_string() );
+                           get_producer_info(prod_name)["last_votepay_share_update"].as_string() );
       BOOST_REQUIRE_EQUAL( get_producer_info(prod_name)["last_claim_time"].as_string(),
                            get_global_state3()["last_vpay_state_update"].as_string() );
       const auto& gs3 = get_global_state3();
       double expected_total_votepay_shares = 0;
       for (uint32_t i = 0; i < producer_names.size(); ++i) {
          const auto& info  = get_producer_info(producer_names[i]);
-         const auto& info2 = get_producer_info2(producer_names[i]);
+         const auto& info2 = get_producer_info(producer_names[i]);
          expected_total_votepay_shares += info2["votepay_share"].as_double();
          expected_total_votepay_shares += info["total_votes"].as_double()
                                            * double( ( microseconds_since_epoch_of_iso_string( gs3["last_vpay_state_update"] )
@@ -1955,7 +2050,7 @@ BOOST_FIXTURE_TEST_CASE(votepay_share_invariant, eosio_system_tester, * boost::u
    produce_block( fc::hours(1) );
 
    BOOST_REQUIRE_EQUAL( success(), push_action(proda, N(claimrewards), mvo()("owner", proda)) );
-   BOOST_TEST_REQUIRE( 0 == get_producer_info2(proda)["votepay_share"].as_double() );
+   BOOST_TEST_REQUIRE( 0 == get_producer_info(proda)["votepay_share"].as_double() );
 
    produce_block( fc::hours(24) );
 
@@ -1964,7 +2059,7 @@ BOOST_FIXTURE_TEST_CASE(votepay_share_invariant, eosio_system_tester, * boost::u
    produce_block( fc::hours(24) );
 
    BOOST_REQUIRE_EQUAL( success(), push_action(prodb, N(claimrewards), mvo()("owner", prodb)) );
-   BOOST_TEST_REQUIRE( 0 == get_producer_info2(prodb)["votepay_share"].as_double() );
+   BOOST_TEST_REQUIRE( 0 == get_producer_info(prodb)["votepay_share"].as_double() );
 
    produce_block( fc::hours(10) );
 
@@ -1977,7 +2072,7 @@ BOOST_FIXTURE_TEST_CASE(votepay_share_invariant, eosio_system_tester, * boost::u
    BOOST_REQUIRE_EQUAL( success(), vote( vota, { proda } ) );
 
    const auto& info  = get_producer_info(prodb);
-   const auto& info2 = get_producer_info2(prodb);
+   const auto& info2 = get_producer_info(prodb);
    const auto& gs2   = get_global_state2();
    const auto& gs3   = get_global_state3();
 
@@ -2024,14 +2119,14 @@ BOOST_FIXTURE_TEST_CASE(votepay_share_proxy, eosio_system_tester, * boost::unit_
    BOOST_REQUIRE_EQUAL( success(), vote( alice, { carol } ) );
    double total_votes = get_producer_info(carol)["total_votes"].as_double();
    BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("450.0003")) == total_votes );
-   BOOST_TEST_REQUIRE( 0 == get_producer_info2(carol)["votepay_share"].as_double() );
-   uint64_t last_update_time = microseconds_since_epoch_of_iso_string( get_producer_info2(carol)["last_votepay_share_update"] );
+   BOOST_TEST_REQUIRE( 0 == get_producer_info(carol)["votepay_share"].as_double() );
+   uint64_t last_update_time = microseconds_since_epoch_of_iso_string( get_producer_info(carol)["last_votepay_share_update"] );
 
    produce_block( fc::hours(15) );
 
    // alice (proxy) votes again for carol
    BOOST_REQUIRE_EQUAL( success(), vote( alice, { carol } ) );
-   auto cur_info2 = get_producer_info2(carol);
+   auto cur_info2 = get_producer_info(carol);
    double expected_votepay_share = double( (microseconds_since_epoch_of_iso_string( cur_info2["last_votepay_share_update"] ) - last_update_time) / 1E6 ) * total_votes;
    BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("450.0003")) == get_producer_info(carol)["total_votes"].as_double() );
    BOOST_TEST_REQUIRE( expected_votepay_share == cur_info2["votepay_share"].as_double() );
@@ -2043,9 +2138,10 @@ BOOST_FIXTURE_TEST_CASE(votepay_share_proxy, eosio_system_tester, * boost::unit_
 
    // bob unstakes
    BOOST_REQUIRE_EQUAL( success(), unstake( bob, core_sym::from_string("10.0002"), core_sym::from_string("10.0001") ) );
+   BOOST_REQUIRE_EQUAL( success(), flushproxies() );
    BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("430.0000")), get_producer_info(carol)["total_votes"].as_double() );
 
-   cur_info2 = get_producer_info2(carol);
+   cur_info2 = get_producer_info(carol);
    expected_votepay_share += double( (microseconds_since_epoch_of_iso_string( cur_info2["last_votepay_share_update"] ) - last_update_time) / 1E6 ) * total_votes;
    BOOST_TEST_REQUIRE( expected_votepay_share == cur_info2["votepay_share"].as_double() );
    BOOST_TEST_REQUIRE( expected_votepay_share == get_global_state2()["total_producer_votepay_share"].as_double() );
@@ -2059,8 +2155,9 @@ BOOST_FIXTURE_TEST_CASE(votepay_share_proxy, eosio_system_tester, * boost::unit_
 
    // bob votes for carol
    BOOST_REQUIRE_EQUAL( success(), vote( bob, { carol } ) );
+   BOOST_REQUIRE_EQUAL( success(), flushproxies() );
    BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("430.0000")), get_producer_info(carol)["total_votes"].as_double() );
-   cur_info2 = get_producer_info2(carol);
+   cur_info2 = get_producer_info(carol);
    expected_votepay_share = double( (microseconds_since_epoch_of_iso_string( cur_info2["last_votepay_share_update"] ) - last_update_time) / 1E6 ) * total_votes;
    BOOST_TEST_REQUIRE( expected_votepay_share == cur_info2["votepay_share"].as_double() );
    BOOST_TEST_REQUIRE( expected_votepay_share == get_global_state2()["total_producer_votepay_share"].as_double() );
@@ -2071,9 +2168,9 @@ BOOST_FIXTURE_TEST_CASE(votepay_share_proxy, eosio_system_tester, * boost::unit_
    // carol hasn't claimed rewards in over 3 days
    total_votes = get_producer_info(carol)["total_votes"].as_double();
    BOOST_REQUIRE_EQUAL( success(), vote( bob, { carol } ) );
-   BOOST_REQUIRE_EQUAL( get_producer_info2(carol)["last_votepay_share_update"].as_string(),
+   BOOST_REQUIRE_EQUAL( get_producer_info(carol)["last_votepay_share_update"].as_string(),
                         get_global_state3()["last_vpay_state_update"].as_string() );
-   BOOST_TEST_REQUIRE( 0 == get_producer_info2(carol)["votepay_share"].as_double() );
+   BOOST_TEST_REQUIRE( 0 == get_producer_info(carol)["votepay_share"].as_double() );
    BOOST_TEST_REQUIRE( 0 == get_global_state2()["total_producer_votepay_share"].as_double() );
    BOOST_TEST_REQUIRE( 0 == get_global_state3()["total_vpay_share_change_rate"].as_double() );
 
@@ -2082,9 +2179,9 @@ BOOST_FIXTURE_TEST_CASE(votepay_share_proxy, eosio_system_tester, * boost::unit_
    // bob votes for carol again
    // carol still hasn't claimed rewards
    BOOST_REQUIRE_EQUAL( success(), vote( bob, { carol } ) );
-   BOOST_REQUIRE_EQUAL(get_producer_info2(carol)["last_votepay_share_update"].as_string(),
+   BOOST_REQUIRE_EQUAL(get_producer_info(carol)["last_votepay_share_update"].as_string(),
                        get_global_state3()["last_vpay_state_update"].as_string() );
-   BOOST_TEST_REQUIRE( 0 == get_producer_info2(carol)["votepay_share"].as_double() );
+   BOOST_TEST_REQUIRE( 0 == get_producer_info(carol)["votepay_share"].as_double() );
    BOOST_TEST_REQUIRE( 0 == get_global_state2()["total_producer_votepay_share"].as_double() );
    BOOST_TEST_REQUIRE( 0 == get_global_state3()["total_vpay_share_change_rate"].as_double() );
 
@@ -2092,7 +2189,7 @@ BOOST_FIXTURE_TEST_CASE(votepay_share_proxy, eosio_system_tester, * boost::unit_
 
    // carol finally claims rewards
    BOOST_REQUIRE_EQUAL( success(), push_action( carol, N(claimrewards), mvo()("owner", carol) ) );
-   BOOST_TEST_REQUIRE( 0           == get_producer_info2(carol)["votepay_share"].as_double() );
+   BOOST_TEST_REQUIRE( 0           == get_producer_info(carol)["votepay_share"].as_double() );
    BOOST_TEST_REQUIRE( 0           == get_global_state2()["total_producer_votepay_share"].as_double() );
    BOOST_TEST_REQUIRE( total_votes == get_global_state3()["total_vpay_share_change_rate"].as_double() );
 
@@ -2100,10 +2197,10 @@ BOOST_FIXTURE_TEST_CASE(votepay_share_proxy, eosio_system_tester, * boost::unit_
 
    // alice votes for carol and emily
    // emily hasn't claimed rewards in over 3 days
-   last_update_time = microseconds_since_epoch_of_iso_string( get_producer_info2(carol)["last_votepay_share_update"] );
+   last_update_time = microseconds_since_epoch_of_iso_string( get_producer_info(carol)["last_votepay_share_update"] );
    BOOST_REQUIRE_EQUAL( success(), vote( alice, { carol, emily } ) );
-   cur_info2 = get_producer_info2(carol);
-   auto cur_info2_emily = get_producer_info2(emily);
+   cur_info2 = get_producer_info(carol);
+   auto cur_info2_emily = get_producer_info(emily);
 
    expected_votepay_share = double( (microseconds_since_epoch_of_iso_string( cur_info2["last_votepay_share_update"] ) - last_update_time) / 1E6 ) * total_votes;
    BOOST_TEST_REQUIRE( expected_votepay_share == cur_info2["votepay_share"].as_double() );
@@ -2120,10 +2217,11 @@ BOOST_FIXTURE_TEST_CASE(votepay_share_proxy, eosio_system_tester, * boost::unit_
 
    // bob chooses alice as proxy
    // emily still hasn't claimed rewards
-   last_update_time = microseconds_since_epoch_of_iso_string( get_producer_info2(carol)["last_votepay_share_update"] );
+   last_update_time = microseconds_since_epoch_of_iso_string( get_producer_info(carol)["last_votepay_share_update"] );
    BOOST_REQUIRE_EQUAL( success(), vote( bob, { }, alice ) );
-   cur_info2 = get_producer_info2(carol);
-   cur_info2_emily = get_producer_info2(emily);
+   BOOST_REQUIRE_EQUAL( success(), flushproxies() );
+   cur_info2 = get_producer_info(carol);
+   cur_info2_emily = get_producer_info(emily);
 
    expected_votepay_share += double( (microseconds_since_epoch_of_iso_string( cur_info2["last_votepay_share_update"] ) - last_update_time) / 1E6 ) * total_votes;
    BOOST_TEST_REQUIRE( expected_votepay_share == cur_info2["votepay_share"].as_double() );
@@ -2193,9 +2291,9 @@ BOOST_FIXTURE_TEST_CASE(votepay_share_update_order, eosio_system_tester, * boost
    }
 
    const auto& carol_info  = get_producer_info(carol);
-   const auto& carol_info2 = get_producer_info2(carol);
+   const auto& carol_info2 = get_producer_info(carol);
    const auto& emily_info  = get_producer_info(emily);
-   const auto& emily_info2 = get_producer_info2(emily);
+   const auto& emily_info2 = get_producer_info(emily);
    const auto& gs3         = get_global_state3();
    BOOST_REQUIRE_EQUAL( carol_info2["last_votepay_share_update"].as_string(), gs3["last_vpay_state_update"].as_string() );
    BOOST_REQUIRE_EQUAL( emily_info2["last_votepay_share_update"].as_string(), gs3["last_vpay_state_update"].as_string() );
@@ -2232,41 +2330,33 @@ BOOST_FIXTURE_TEST_CASE(votepay_transition, eosio_system_tester, * boost::unit_t
       for (const auto& p: producer_names) {
          BOOST_REQUIRE_EQUAL( success(), regproducer(p) );
          BOOST_TEST_REQUIRE(0 == get_producer_info(p)["total_votes"].as_double());
-         BOOST_TEST_REQUIRE(0 == get_producer_info2(p)["votepay_share"].as_double());
-         BOOST_REQUIRE(0 < microseconds_since_epoch_of_iso_string( get_producer_info2(p)["last_votepay_share_update"] ));
+         BOOST_TEST_REQUIRE(0 == get_producer_info(p)["votepay_share"].as_double());
+         BOOST_REQUIRE(0 < microseconds_since_epoch_of_iso_string( get_producer_info(p)["last_votepay_share_update"] ));
       }
    }
 
    BOOST_REQUIRE_EQUAL( success(), vote(N(producvotera), vector<account_name>(producer_names.begin(), producer_names.end())) );
-   auto* tbl = control->db().find<eosio::chain::table_id_object, eosio::chain::by_code_scope_table>(
-                  boost::make_tuple( config::system_account_name,
-                                     config::system_account_name,
-                                     N(producers2) ) );
-   BOOST_REQUIRE( tbl );
-   BOOST_REQUIRE( 0 < microseconds_since_epoch_of_iso_string( get_producer_info2("defproducera")["last_votepay_share_update"] ) );
+   BOOST_REQUIRE( 0 < microseconds_since_epoch_of_iso_string( get_producer_info("defproducera")["last_votepay_share_update"] ) );
 
-   // const_cast hack for now
-   const_cast<chainbase::database&>(control->db()).remove( *tbl );
-   tbl = control->db().find<eosio::chain::table_id_object, eosio::chain::by_code_scope_table>(
+   // votepay state is kept in the producers rows, the legacy producers2 table is never created
+   BOOST_REQUIRE_EQUAL( success(), vote(N(producvoterb), vector<account_name>(producer_names.begin(), producer_names.end())) );
+   auto* tbl = control->db().find<eosio::chain::table_id_object, eosio::chain::by_code_scope_table>(
                   boost::make_tuple( config::system_account_name,
                                      config::system_account_name,
                                      N(producers2) ) );
    BOOST_REQUIRE( !tbl );
-
-   BOOST_REQUIRE_EQUAL( success(), vote(N(producvoterb), vector<account_name>(producer_names.begin(), producer_names.end())) );
-   tbl = control->db().find<eosio::chain::table_id_object, eosio::chain::by_code_scope_table>(
-            boost::make_tuple( config::system_account_name,
-                               config::system_account_name,
-                               N(producers2) ) );
-   BOOST_REQUIRE( !tbl );
+   BOOST_REQUIRE_EQUAL( 3, get_producer_info(N(defproducera))["version"].as<uint32_t>() );
+   BOOST_REQUIRE_EQUAL( success(), push_action( N(alice1111111), N(migrateprods), mvo()("max_producers", 10) ) );
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg( "max_producers must be positive" ),
+                        push_action( N(alice1111111), N(migrateprods), mvo()("max_producers", 0) ) );
    BOOST_REQUIRE_EQUAL( success(), regproducer(N(defproducera)) );
-   BOOST_REQUIRE( microseconds_since_epoch_of_iso_string( get_producer_info(N(defproducera))["last_claim_time"] ) < microseconds_since_epoch_of_iso_string( get_producer_info2(N(defproducera))["last_votepay_share_update"] ) );
+   BOOST_REQUIRE( microseconds_since_epoch_of_iso_string( get_producer_info(N(defproducera))["last_claim_time"] ) < microseconds_since_epoch_of_iso_string( get_producer_info(N(defproducera))["last_votepay_share_update"] ) );
 
    create_account_with_resources( N(defproducer1), config::system_account_name, core_sym::from_string("1.0000"), false, net, cpu );
    BOOST_REQUIRE_EQUAL( success(), regproducer(N(defproducer1)) );
    BOOST_REQUIRE( 0 < microseconds_since_epoch_of_iso_string( get_producer_info(N(defproducer1))["last_claim_time"] ) );
    BOOST_REQUIRE_EQUAL( get_producer_info(N(defproducer1))["last_claim_time"].as_string(),
-                        get_producer_info2(N(defproducer1))["last_votepay_share_update"].as_string() );
+                        get_producer_info(N(defproducer1))["last_votepay_share_update"].as_string() );
 
 } FC_LOG_AND_RETHROW()
 
@@ -2347,6 +2437,148 @@ BOOST_AUTO_TEST_CASE(votepay_transition2, * boost::unit_test::tolerance(1e-10))
    BOOST_TEST_REQUIRE( t.get_producer_info(producer_names[0])["total_votes"].as_double() + t.get_producer_info(producer_names[1])["total_votes"].as_double() ==
                        t.get_global_state3()["total_vpay_share_change_rate"].as_double() );
 
+   // rows of the old contract list the producers by name until the vote is cast again, producers get an id
+   // when they register again or are first voted for
+   BOOST_REQUIRE( !t.get_voter_info(N(producvoterc)).get_object().contains("version") );
+   BOOST_REQUIRE( t.get_voter_producers(N(producvoterc)) == producer_names );
+   BOOST_REQUIRE( t.get_producer_info(producer_names[1]).get_object().contains("producer_id") );
+   BOOST_REQUIRE( !t.get_producer_info(producer_names[0]).get_object().contains("producer_id") );
+   const vector<account_name> first_two( producer_names.begin(), producer_names.begin() + 2 );
+   BOOST_REQUIRE_EQUAL( t.success(), t.vote(N(producvoterc), first_two) );
+   const auto voterc = t.get_voter_info(N(producvoterc));
+   BOOST_REQUIRE_EQUAL( 1, voterc["version"].as<uint32_t>() );
+   BOOST_REQUIRE( voterc["producers"].get_array().empty() );
+   BOOST_REQUIRE( t.get_voter_producers(N(producvoterc)) == first_two );
+   BOOST_REQUIRE_EQUAL( 4, t.get_producer_info(producer_names[0])["version"].as<uint32_t>() );
+   BOOST_TEST_REQUIRE( t.get_producer_info(producer_names[2])["total_votes"].as_double() + voterc["last_vote_weight"].as_double() ==
+                       t.get_producer_info(producer_names[0])["total_votes"].as_double() );
+
+} FC_LOG_AND_RETHROW()
+
+
+BOOST_AUTO_TEST_CASE(legacy_rows_are_migrated, * boost::unit_test::tolerance(1e-10)) try {
+   eosio_system_tester t(eosio_system_tester::setup_level::minimal);
+
+   std::string old_contract_core_symbol_name = "SYS"; // Set to core symbol used in contracts::util::system_wasm_old()
+   symbol old_contract_core_symbol{::eosio::chain::string_to_symbol_c( 4, old_contract_core_symbol_name.c_str() )};
+
+   auto old_core_from_string = [&]( const std::string& s ) {
+      return eosio::chain::asset::from_string(s + " " + old_contract_core_symbol_name);
+   };
+
+   t.create_core_token( old_contract_core_symbol );
+   t.set_code( config::system_account_name, contracts::util::system_wasm_old() );
+   t.set_abi(  config::system_account_name, contracts::util::system_abi_old().data() );
+   {
+      const auto& accnt = t.control->db().get<account_object,by_name>( config::system_account_name );
+      abi_def abi;
+      BOOST_REQUIRE_EQUAL(abi_serializer::to_abi(accnt.abi, abi), true);
+      t.abi_ser.set_abi(abi, eosio_system_tester::abi_serializer_max_time);
+   }
+   const asset net = old_core_from_string("80.0000");
+   const asset cpu = old_core_from_string("80.0000");
+   const std::vector<account_name> voters = { N(producvotera), N(producvoterb), N(producvoterc), N(producvoterd) };
+   for (const auto& v: voters) {
+      t.create_account_with_resources( v, config::system_account_name, old_core_from_string("1.0000"), false, net, cpu );
+      t.transfer( config::system_account_name, v, old_core_from_string("100000000.0000"), config::system_account_name );
+      BOOST_REQUIRE_EQUAL(t.success(), t.stake(v, old_core_from_string("30000000.0000"), old_core_from_string("30000000.0000")) );
+   }
+
+   const std::vector<account_name> producer_names = { N(defproducera), N(defproducerb), N(defproducerc), N(defproducerd) };
+   t.setup_producer_accounts( producer_names, old_core_from_string("1.0000"),
+                              old_core_from_string("80.0000"), old_core_from_string("80.0000") );
+   for (const auto& p: producer_names) {
+      BOOST_REQUIRE_EQUAL( t.success(), t.regproducer(p) );
+   }
+
+   BOOST_REQUIRE_EQUAL( t.success(), t.vote(N(producvotera), producer_names) );
+   BOOST_REQUIRE_EQUAL( t.success(), t.vote(N(producvoterb), { N(defproducera), N(defproducerb) }) );
+   BOOST_REQUIRE_EQUAL( t.success(), t.push_action( N(producvoterd), N(regproxy), mvo()("proxy", "producvoterd")("isproxy", true) ) );
+   BOOST_REQUIRE_EQUAL( t.success(), t.vote(N(producvoterd), { N(defproducerc) }) );
+   BOOST_REQUIRE_EQUAL( t.success(), t.vote(N(producvoterc), vector<account_name>(), N(producvoterd)) );
+   t.produce_block();
+
+   t.deploy_contract( false );
+   t.produce_blocks(2);
+
+   // stores a row of the producers2 table, in which contract versions after the old one kept the votepay state
+   auto store_producer_info2 = [&]( const account_name& owner, double share ) {
+      auto& db = const_cast<chainbase::database&>( t.control->db() );
+      const auto* tbl = db.find<table_id_object, by_code_scope_table>(
+                           boost::make_tuple( config::system_account_name, config::system_account_name, N(producers2) ) );
+      if( !tbl ) {
+         tbl = &db.create<table_id_object>( [&]( auto& t_id ) {
+               t_id.code  = config::system_account_name;
+               t_id.scope = config::system_account_name;
+               t_id.table = N(producers2);
+               t_id.payer = config::system_account_name;
+            });
+      }
+      const auto data = t.abi_ser.variant_to_binary( "producer_info2",
+                                                     mvo()("owner", owner)("votepay_share", share)("last_votepay_share_update", t.control->head_block_time()),
+                                                     eosio_system_tester::abi_serializer_max_time );
+      db.create<key_value_object>( [&]( auto& o ) {
+            o.t_id        = tbl->id;
+            o.primary_key = uint64_t(owner);
+            o.payer       = config::system_account_name;
+            o.value.assign( data.data(), data.size() );
+         });
+      db.modify( *tbl, []( auto& t_id ) { ++t_id.count; } );
+   };
+
+   // defproducerb has votepay state in its producers row already, which is kept
+   BOOST_REQUIRE_EQUAL( t.success(), t.regproducer(N(defproducerb)) );
+   store_producer_info2( N(defproducerb), 9.0 );
+   store_producer_info2( N(defproducerc), 5.0 );
+   store_producer_info2( N(defproducerd), 7.0 );
+   BOOST_TEST_REQUIRE( 5.0 == t.get_producer_info2(N(defproducerc))["votepay_share"].as_double() );
+   BOOST_REQUIRE( 0 == microseconds_since_epoch_of_iso_string( t.get_producer_info(N(defproducerc))["last_votepay_share_update"] ) );
+
+   // touching a producer moves its legacy row, onblock has rebased the votes already and the votepay share,
+   // relative to epoch 0, is scaled to the vote epoch of the row
+   BOOST_REQUIRE_EQUAL( t.success(), t.regproducer(N(defproducerc)) );
+   BOOST_REQUIRE( t.get_producer_info2(N(defproducerc)).is_null() );
+   const auto prodc = t.get_producer_info(N(defproducerc));
+   const uint32_t epoch = t.get_global_state4()["vote_epoch"].as<uint32_t>();
+   BOOST_REQUIRE_EQUAL( epoch, prodc["vote_epoch"].as<uint32_t>() );
+   BOOST_TEST_REQUIRE( std::ldexp( 5.0, -int(epoch) ) == prodc["votepay_share"].as_double() );
+
+   // migrateprods moves the remaining rows, and drops those of producers that have votepay state already
+   BOOST_REQUIRE_EQUAL( t.success(), t.push_action( N(defproducera), N(migrateprods), mvo()("max_producers", 1) ) );
+   BOOST_REQUIRE( t.get_producer_info2(N(defproducerb)).is_null() );
+   BOOST_TEST_REQUIRE( 0 == t.get_producer_info(N(defproducerb))["votepay_share"].as_double() );
+   BOOST_TEST_REQUIRE( 7.0 == t.get_producer_info2(N(defproducerd))["votepay_share"].as_double() );
+   BOOST_REQUIRE_EQUAL( t.success(), t.push_action( N(defproducera), N(migrateprods), mvo()("max_producers", 10) ) );
+   BOOST_REQUIRE( t.get_producer_info2(N(defproducerd)).is_null() );
+   const auto prodd = t.get_producer_info(N(defproducerd));
+   BOOST_REQUIRE_EQUAL( epoch, prodd["vote_epoch"].as<uint32_t>() );
+   BOOST_TEST_REQUIRE( std::ldexp( 7.0, -int(epoch) ) == prodd["votepay_share"].as_double() );
+   BOOST_REQUIRE( !t.control->db().find<table_id_object, by_code_scope_table>(
+                     boost::make_tuple( config::system_account_name, config::system_account_name, N(producers2) ) ) );
+
+   auto get_vote_count = [&]( const account_name& owner ) {
+      vector<char> data = t.get_row_by_account( config::system_account_name, config::system_account_name, N(votecounts), owner );
+      return data.empty() ? fc::variant() : t.abi_ser.binary_to_variant( "vote_count", data, eosio_system_tester::abi_serializer_max_time );
+   };
+
+   // the voters of the old contract are counted by buildcounts, votes cast in the meantime are counted once
+   BOOST_REQUIRE_EQUAL( false, t.get_global_state4()["counts_built"].as<bool>() );
+   BOOST_REQUIRE_EQUAL( t.success(), t.push_action( N(defproducera), N(buildcounts), mvo()("max_voters", 1) ) );
+   BOOST_REQUIRE_EQUAL( false, t.get_global_state4()["counts_built"].as<bool>() );
+   BOOST_REQUIRE_EQUAL( t.success(), t.vote(N(producvoterb), { N(defproducera), N(defproducerc) }) );
+   while( !t.get_global_state4()["counts_built"].as<bool>() ) {
+      t.produce_block();
+      BOOST_REQUIRE_EQUAL( t.success(), t.push_action( N(defproducera), N(buildcounts), mvo()("max_voters", 2) ) );
+   }
+   BOOST_REQUIRE_EQUAL( 2, get_vote_count( N(defproducera) )["voter_count"].as<uint32_t>() );
+   BOOST_REQUIRE_EQUAL( 1, get_vote_count( N(defproducerb) )["voter_count"].as<uint32_t>() );
+   BOOST_REQUIRE_EQUAL( 3, get_vote_count( N(defproducerc) )["voter_count"].as<uint32_t>() );
+   BOOST_REQUIRE_EQUAL( 1, get_vote_count( N(defproducerd) )["voter_count"].as<uint32_t>() );
+   REQUIRE_MATCHING_OBJECT( mvo()("owner", "producvoterd")("voter_count", 0)("delegator_count", 1), get_vote_count( N(producvoterd) ) );
+   BOOST_REQUIRE_EQUAL( t.success(), t.vote(N(producvoterc), { N(defproducerd) }) );
+   BOOST_REQUIRE( get_vote_count( N(producvoterd) ).is_null() );
+   BOOST_REQUIRE_EQUAL( 2, get_vote_count( N(defproducerd) )["voter_count"].as<uint32_t>() );
+
 } FC_LOG_AND_RETHROW()
 
 
@@ -2492,13 +2724,13 @@ BOOST_FIXTURE_TEST_CASE(producer_onblock_check, eosio_system_tester) try {
       produce_blocks(21 * 12);
       bool all_21_produced = true;
       for (uint32_t i = 0; i < 21; ++i) {
-         if (0 == get_producer_info(producer_names[i])["unpaid_blocks"].as<uint32_t>()) {
+         if (0 == get_current_producer_info(producer_names[i])["unpaid_blocks"].as<uint32_t>()) {
             all_21_produced= false;
          }
       }
       bool rest_didnt_produce = true;
       for (uint32_t i = 21; i < producer_names.size(); ++i) {
-         if (0 < get_producer_info(producer_names[i])["unpaid_blocks"].as<uint32_t>()) {
+         if (0 < get_current_producer_info(producer_names[i])["unpaid_blocks"].as<uint32_t>()) {
             rest_didnt_produce = false;
          }
       }
@@ -2508,7 +2740,7 @@ BOOST_FIXTURE_TEST_CASE(producer_onblock_check, eosio_system_tester) try {
 
    {
       const char* claimrewards_activation_error_message = "cannot claim rewards until the chain is activated (at least 15% of all tokens participate in voting)";
-      BOOST_CHECK_EQUAL(0, get_global_state()["total_unpaid_blocks"].as<uint32_t>());
+      BOOST_CHECK_EQUAL(0, get_current_global_state()["total_unpaid_blocks"].as<uint32_t>());
       BOOST_REQUIRE_EQUAL(wasm_assert_msg( claimrewards_activation_error_message ),
                           push_action(producer_names.front(), N(claimrewards), mvo()("owner", producer_names.front())));
       BOOST_REQUIRE_EQUAL(0, get_balance(producer_names.front()).get_amount());
@@ -2531,13 +2763,13 @@ BOOST_FIXTURE_TEST_CASE(producer_onblock_check, eosio_system_tester) try {
       produce_blocks(21 * 12);
       bool all_21_produced = true;
       for (uint32_t i = 0; i < 21; ++i) {
-         if (0 == get_producer_info(producer_names[i])["unpaid_blocks"].as<uint32_t>()) {
+         if (0 == get_current_producer_info(producer_names[i])["unpaid_blocks"].as<uint32_t>()) {
             all_21_produced= false;
          }
       }
       bool rest_didnt_produce = true;
       for (uint32_t i = 21; i < producer_names.size(); ++i) {
-         if (0 < get_producer_info(producer_names[i])["unpaid_blocks"].as<uint32_t>()) {
+         if (0 < get_current_producer_info(producer_names[i])["unpaid_blocks"].as<uint32_t>()) {
             rest_didnt_produce = false;
          }
       }
@@ -2587,6 +2819,7 @@ BOOST_FIXTURE_TEST_CASE( voters_actions_affect_proxy_and_producers, eosio_system
    issue( "bob111111111", core_sym::from_string("1000.0000"),  config::system_account_name );
    BOOST_REQUIRE_EQUAL( success(), stake( "bob111111111", core_sym::from_string("100.0002"), core_sym::from_string("50.0001") ) );
    BOOST_REQUIRE_EQUAL( success(), vote( N(bob111111111), vector<account_name>(), "alice1111111" ) );
+   produce_block(); // onblock applies the queued proxy weight changes
    BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("150.0003")) == get_voter_info( "alice1111111" )["proxied_vote_weight"].as_double() );
    BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("200.0005")) == get_producer_info( "defproducer1" )["total_votes"].as_double() );
    BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("200.0005")) == get_producer_info( "defproducer2" )["total_votes"].as_double() );
@@ -2596,6 +2829,7 @@ BOOST_FIXTURE_TEST_CASE( voters_actions_affect_proxy_and_producers, eosio_system
    issue( "carol1111111", core_sym::from_string("1000.0000"),  config::system_account_name );
    BOOST_REQUIRE_EQUAL( success(), stake( "carol1111111", core_sym::from_string("30.0001"), core_sym::from_string("20.0001") ) );
    BOOST_REQUIRE_EQUAL( success(), vote( N(carol1111111), vector<account_name>(), "alice1111111" ) );
+   produce_block();
    BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("200.0005")) == get_voter_info( "alice1111111" )["proxied_vote_weight"].as_double() );
    BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("250.0007")) == get_producer_info( "defproducer1" )["total_votes"].as_double() );
    BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("250.0007")) == get_producer_info( "defproducer2" )["total_votes"].as_double() );
@@ -2603,6 +2837,7 @@ BOOST_FIXTURE_TEST_CASE( voters_actions_affect_proxy_and_producers, eosio_system
 
    //proxied voter carol1111111 increases stake
    BOOST_REQUIRE_EQUAL( success(), stake( "carol1111111", core_sym::from_string("50.0000"), core_sym::from_string("70.0000") ) );
+   produce_block();
    BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("320.0005")) == get_voter_info( "alice1111111" )["proxied_vote_weight"].as_double() );
    BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("370.0007")) == get_producer_info( "defproducer1" )["total_votes"].as_double() );
    BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("370.0007")) == get_producer_info( "defproducer2" )["total_votes"].as_double() );
@@ -2610,6 +2845,7 @@ BOOST_FIXTURE_TEST_CASE( voters_actions_affect_proxy_and_producers, eosio_system
 
    //proxied voter bob111111111 decreases stake
    BOOST_REQUIRE_EQUAL( success(), unstake( "bob111111111", core_sym::from_string("50.0001"), core_sym::from_string("50.0001") ) );
+   produce_block();
    BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("220.0003")) == get_voter_info( "alice1111111" )["proxied_vote_weight"].as_double() );
    BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("270.0005")) == get_producer_info( "defproducer1" )["total_votes"].as_double() );
    BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("270.0005")) == get_producer_info( "defproducer2" )["total_votes"].as_double() );
@@ -2617,6 +2853,7 @@ BOOST_FIXTURE_TEST_CASE( voters_actions_affect_proxy_and_producers, eosio_system
 
    //proxied voter carol1111111 chooses another proxy
    BOOST_REQUIRE_EQUAL( success(), vote( N(carol1111111), vector<account_name>(), "donald111111" ) );
+   produce_block();
    BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("50.0001")), get_voter_info( "alice1111111" )["proxied_vote_weight"].as_double() );
    BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("170.0002")), get_voter_info( "donald111111" )["proxied_vote_weight"].as_double() );
    BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("100.0003")), get_producer_info( "defproducer1" )["total_votes"].as_double() );
@@ -2625,6 +2862,7 @@ BOOST_FIXTURE_TEST_CASE( voters_actions_affect_proxy_and_producers, eosio_system
 
    //bob111111111 switches to direct voting and votes for one of the same producers, but not for another one
    BOOST_REQUIRE_EQUAL( success(), vote( N(bob111111111), { N(defproducer2) } ) );
+   produce_block();
    BOOST_TEST_REQUIRE( 0.0 == get_voter_info( "alice1111111" )["proxied_vote_weight"].as_double() );
    BOOST_TEST_REQUIRE(  stake2votes(core_sym::from_string("50.0002")), get_producer_info( "defproducer1" )["total_votes"].as_double() );
    BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("100.0003")), get_producer_info( "defproducer2" )["total_votes"].as_double() );
@@ -2633,6 +2871,605 @@ BOOST_FIXTURE_TEST_CASE( voters_actions_affect_proxy_and_producers, eosio_system
 } FC_LOG_AND_RETHROW()
 
 
+BOOST_FIXTURE_TEST_CASE( proxy_weight_changes_are_queued, eosio_system_tester, * boost::unit_test::tolerance(1e-10) ) try {
+   cross_15_percent_threshold();
+
+   create_accounts_with_resources( { N(defproducer1), N(defproducer2) } );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer1", 1) );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer2", 2) );
+
+   //alice1111111 becomes a proxy, stakes and votes
+   BOOST_REQUIRE_EQUAL( success(), push_action( N(alice1111111), N(regproxy), mvo()
+                                                ("proxy",  "alice1111111")
+                                                ("isproxy", true)
+                        )
+   );
+   issue( "alice1111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   BOOST_REQUIRE_EQUAL( success(), stake( "alice1111111", core_sym::from_string("30.0001"), core_sym::from_string("20.0001") ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), { N(defproducer1), N(defproducer2) } ) );
+   produce_block();
+   BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("50.0002")) == get_producer_info( "defproducer1" )["total_votes"].as_double() );
+   BOOST_REQUIRE( get_row_by_account( config::system_account_name, config::system_account_name, N(dirtyproxies), N(alice1111111) ).empty() );
+
+   //bob111111111 and carol1111111 choose alice1111111 as a proxy and change their stakes
+   issue( "bob111111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   issue( "carol1111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   BOOST_REQUIRE_EQUAL( success(), stake( "bob111111111", core_sym::from_string("100.0002"), core_sym::from_string("50.0001") ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(bob111111111), vector<account_name>(), "alice1111111" ) );
+   BOOST_REQUIRE_EQUAL( success(), stake( "carol1111111", core_sym::from_string("30.0001"), core_sym::from_string("20.0001") ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(carol1111111), vector<account_name>(), "alice1111111" ) );
+   BOOST_REQUIRE_EQUAL( success(), stake( "bob111111111", core_sym::from_string("10.0000"), core_sym::from_string("10.0000") ) );
+   BOOST_REQUIRE_EQUAL( success(), unstake( "carol1111111", core_sym::from_string("10.0000"), core_sym::from_string("10.0000") ) );
+
+   //proxied weight is up to date while the producers wait for the queue to be flushed
+   BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("200.0005")) == get_voter_info( "alice1111111" )["proxied_vote_weight"].as_double() );
+   BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("50.0002")) == get_producer_info( "defproducer1" )["total_votes"].as_double() );
+   BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("50.0002")) == get_producer_info( "defproducer2" )["total_votes"].as_double() );
+   BOOST_REQUIRE( !get_row_by_account( config::system_account_name, config::system_account_name, N(dirtyproxies), N(alice1111111) ).empty() );
+
+   //all of the changes are applied at once
+   BOOST_REQUIRE_EQUAL( success(), flushproxies() );
+   BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("250.0007")) == get_producer_info( "defproducer1" )["total_votes"].as_double() );
+   BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("250.0007")) == get_producer_info( "defproducer2" )["total_votes"].as_double() );
+   BOOST_REQUIRE( get_row_by_account( config::system_account_name, config::system_account_name, N(dirtyproxies), N(alice1111111) ).empty() );
+
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg( "max_proxies must be positive" ), flushproxies( 0 ) );
+
+} FC_LOG_AND_RETHROW()
+
+BOOST_FIXTURE_TEST_CASE( stake_change_updates_cast_votes, eosio_system_tester, * boost::unit_test::tolerance(1e-10) ) try {
+   cross_15_percent_threshold();
+
+   create_accounts_with_resources( { N(defproducer1), N(defproducer2) } );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer1", 1) );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer2", 2) );
+
+   //alice1111111 votes for producers, bob111111111 for alice1111111 as a proxy
+   issue( "alice1111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   issue( "bob111111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   BOOST_REQUIRE_EQUAL( success(), push_action( N(alice1111111), N(regproxy), mvo()("proxy", "alice1111111")("isproxy", true) ) );
+   BOOST_REQUIRE_EQUAL( success(), stake( "alice1111111", core_sym::from_string("30.0001"), core_sym::from_string("20.0001") ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), { N(defproducer1), N(defproducer2) } ) );
+   BOOST_REQUIRE_EQUAL( success(), stake( "bob111111111", core_sym::from_string("100.0002"), core_sym::from_string("50.0001") ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(bob111111111), vector<account_name>(), "alice1111111" ) );
+   BOOST_REQUIRE_EQUAL( success(), flushproxies() );
+   BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("200.0005")) == get_producer_info( "defproducer1" )["total_votes"].as_double() );
+
+   //stake changes keep the vote and apply only the difference in weight
+   BOOST_REQUIRE_EQUAL( success(), stake( "alice1111111", core_sym::from_string("10.0000"), core_sym::from_string("10.0000") ) );
+   BOOST_REQUIRE_EQUAL( success(), unstake( "bob111111111", core_sym::from_string("50.0000"), core_sym::from_string("0.0000") ) );
+   BOOST_REQUIRE_EQUAL( success(), flushproxies() );
+   REQUIRE_MATCHING_OBJECT( proxy( "alice1111111" )( "staked", core_sym::from_string("70.0002").get_amount() )
+                            ( "proxied_vote_weight", stake2votes(core_sym::from_string("100.0003")) ), get_voter_info( "alice1111111" ) );
+   BOOST_REQUIRE( get_voter_producers( "alice1111111" ) == vector<account_name>({ N(defproducer1), N(defproducer2) }) );
+   REQUIRE_MATCHING_OBJECT( voter( "bob111111111", core_sym::from_string("100.0003") )( "proxy", "alice1111111" ), get_voter_info( "bob111111111" ) );
+   BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("170.0005")) == get_voter_info( "alice1111111" )["last_vote_weight"].as_double() );
+   BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("170.0005")) == get_producer_info( "defproducer1" )["total_votes"].as_double() );
+   BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("170.0005")) == get_producer_info( "defproducer2" )["total_votes"].as_double() );
+
+} FC_LOG_AND_RETHROW()
+
+BOOST_FIXTURE_TEST_CASE( producer_tallies_are_whole_vote_units, eosio_system_tester ) try {
+   create_accounts_with_resources( { N(defproducer1), N(defproducer2) } );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer1", 1) );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer2", 2) );
+
+   issue( "alice1111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   issue( "bob111111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   BOOST_REQUIRE_EQUAL( success(), stake( "alice1111111", core_sym::from_string("30.0001"), core_sym::from_string("20.0001") ) );
+   BOOST_REQUIRE_EQUAL( success(), stake( "bob111111111", core_sym::from_string("10.0003"), core_sym::from_string("0.0004") ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), { N(defproducer1), N(defproducer2) } ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(bob111111111), { N(defproducer1) } ) );
+   BOOST_REQUIRE_EQUAL( success(), stake( "bob111111111", core_sym::from_string("0.0001"), core_sym::from_string("0.0000") ) );
+
+   //every vote is rounded to whole units once, so the tallies are exact sums of the votes
+   const auto alice_units = eosiosystem::to_vote_units( get_voter_info( "alice1111111" )["last_vote_weight"].as_double() );
+   const auto bob_units   = eosiosystem::to_vote_units( get_voter_info( "bob111111111" )["last_vote_weight"].as_double() );
+   BOOST_REQUIRE_EQUAL( eosiosystem::from_vote_units( alice_units + bob_units ), get_producer_info( "defproducer1" )["total_votes"].as_double() );
+   BOOST_REQUIRE_EQUAL( eosiosystem::from_vote_units( alice_units ), get_producer_info( "defproducer2" )["total_votes"].as_double() );
+   BOOST_REQUIRE_EQUAL( eosiosystem::from_vote_units( 2 * alice_units + bob_units ), get_current_global_state()["total_producer_vote_weight"].as_double() );
+   BOOST_REQUIRE_EQUAL( 3, get_producer_info( "defproducer1" )["version"].as<uint32_t>() );
+
+   //and, within a vote epoch, withdrawing the votes in any order brings them back to exactly zero
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), { N(defproducer2) } ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(bob111111111), vector<account_name>() ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), vector<account_name>() ) );
+   BOOST_REQUIRE_EQUAL( 0, get_producer_info( "defproducer1" )["total_votes"].as_double() );
+   BOOST_REQUIRE_EQUAL( 0, get_producer_info( "defproducer2" )["total_votes"].as_double() );
+   BOOST_REQUIRE_EQUAL( 0, get_current_global_state()["total_producer_vote_weight"].as_double() );
+
+} FC_LOG_AND_RETHROW()
+
+BOOST_FIXTURE_TEST_CASE( proxied_weight_is_sum_of_delegator_units, eosio_system_tester ) try {
+   issue( "alice1111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   issue( "bob111111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   issue( "carol1111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   BOOST_REQUIRE_EQUAL( success(), push_action( N(alice1111111), N(regproxy), mvo()("proxy", "alice1111111")("isproxy", true) ) );
+   BOOST_REQUIRE_EQUAL( success(), stake( "bob111111111", core_sym::from_string("10.0003"), core_sym::from_string("0.0004") ) );
+   BOOST_REQUIRE_EQUAL( success(), stake( "carol1111111", core_sym::from_string("0.0007"), core_sym::from_string("0.0001") ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(bob111111111), vector<account_name>(), "alice1111111" ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(carol1111111), vector<account_name>(), "alice1111111" ) );
+
+   //changes of the delegated weights are applied in whole vote units, so none of them is lost to rounding
+   BOOST_REQUIRE_EQUAL( success(), stake( "bob111111111", core_sym::from_string("0.0001"), core_sym::from_string("0.0000") ) );
+   BOOST_REQUIRE_EQUAL( success(), stake( "carol1111111", core_sym::from_string("3.0001"), core_sym::from_string("0.0000") ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(carol1111111), vector<account_name>() ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(carol1111111), vector<account_name>(), "alice1111111" ) );
+
+   auto units = [&]( const string& owner, const string& field ) { return get_voter_info( owner )[field].as<int64_t>(); };
+   const int64_t delegated = units( "bob111111111", "last_vote_units" ) + units( "carol1111111", "last_vote_units" );
+   BOOST_REQUIRE_EQUAL( delegated, units( "alice1111111", "proxied_vote_units" ) );
+   BOOST_REQUIRE_EQUAL( eosiosystem::from_vote_units( delegated ), get_voter_info( "alice1111111" )["proxied_vote_weight"].as_double() );
+
+} FC_LOG_AND_RETHROW()
+
+BOOST_AUTO_TEST_CASE( producer_ids_round_trip ) try {
+   const std::vector<uint32_t> ids = { 0, 1, 5, 132, 133, 20000, 4294967295u };
+   const auto data = eosiosystem::encode_producer_ids( ids );
+   // deltas below 128 take a byte, below 16384 two, below 2^21 three, the largest five
+   BOOST_REQUIRE_EQUAL( 1 + 1 + 1 + 1 + 1 + 3 + 5, data.size() );
+   BOOST_REQUIRE( ids == eosiosystem::decode_producer_ids( data ) );
+   BOOST_REQUIRE( eosiosystem::encode_producer_ids( {} ).empty() );
+   BOOST_REQUIRE( eosiosystem::decode_producer_ids( {} ).empty() );
+} FC_LOG_AND_RETHROW()
+
+BOOST_FIXTURE_TEST_CASE( voter_rows_list_producer_ids, eosio_system_tester ) try {
+   create_accounts_with_resources( { N(defproducer1), N(defproducer2), N(defproducer3) } );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer3", 1) );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer1", 2) );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer2", 3) );
+
+   //producers get consecutive ids when they register, the registry maps them back
+   auto id_of = [&]( const account_name& p ) { return get_producer_info( p )["producer_id"].as<uint32_t>(); };
+   BOOST_REQUIRE_EQUAL( 4, get_producer_info( "defproducer1" )["version"].as<uint32_t>() );
+   BOOST_REQUIRE_EQUAL( id_of( "defproducer3" ) + 1, id_of( "defproducer1" ) );
+   BOOST_REQUIRE_EQUAL( id_of( "defproducer1" ) + 1, id_of( "defproducer2" ) );
+   BOOST_REQUIRE_EQUAL( id_of( "defproducer2" ) + 1, get_global_state4()["next_producer_id"].as<uint32_t>() );
+   vector<char> data = get_row_by_account( config::system_account_name, config::system_account_name, N(producerids), id_of( "defproducer1" ) );
+   BOOST_REQUIRE_EQUAL( "defproducer1", abi_ser.binary_to_variant( "producer_id_info", data, abi_serializer_max_time )["owner"].as_string() );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer1", 2) );
+   BOOST_REQUIRE_EQUAL( id_of( "defproducer2" ) + 1, get_global_state4()["next_producer_id"].as<uint32_t>() );
+
+   //the producers voted for are stored as their delta-encoded ids, sorted by id rather than by name
+   issue( "alice1111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   BOOST_REQUIRE_EQUAL( success(), stake( "alice1111111", core_sym::from_string("30.0001"), core_sym::from_string("20.0001") ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), { N(defproducer1), N(defproducer3) } ) );
+   auto info = get_voter_info( "alice1111111" );
+   BOOST_REQUIRE_EQUAL( 1, info["version"].as<uint32_t>() );
+   BOOST_REQUIRE( info["producers"].get_array().empty() );
+   BOOST_REQUIRE( eosiosystem::encode_producer_ids( { id_of( "defproducer3" ), id_of( "defproducer1" ) } ) == info["producer_ids"].as<vector<char>>() );
+   BOOST_REQUIRE( get_voter_producers( "alice1111111" ) == vector<account_name>({ N(defproducer1), N(defproducer3) }) );
+   BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("50.0002")) == get_producer_info( "defproducer1" )["total_votes"].as_double() );
+   BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("50.0002")) == get_producer_info( "defproducer3" )["total_votes"].as_double() );
+
+   //stake changes and new votes are applied to the producers listed by id
+   BOOST_REQUIRE_EQUAL( success(), stake( "alice1111111", core_sym::from_string("10.0000"), core_sym::from_string("0.0000") ) );
+   BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("60.0002")) == get_producer_info( "defproducer3" )["total_votes"].as_double() );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), { N(defproducer2), N(defproducer3) } ) );
+   BOOST_TEST_REQUIRE( 0 == get_producer_info( "defproducer1" )["total_votes"].as_double() );
+   BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("60.0002")) == get_producer_info( "defproducer2" )["total_votes"].as_double() );
+   BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("60.0002")) == get_producer_info( "defproducer3" )["total_votes"].as_double() );
+   BOOST_REQUIRE( get_voter_producers( "alice1111111" ) == vector<account_name>({ N(defproducer2), N(defproducer3) }) );
+
+   //a vote for a proxy lists no producers
+   BOOST_REQUIRE_EQUAL( success(), push_action( N(bob111111111), N(regproxy), mvo()("proxy", "bob111111111")("isproxy", true) ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), vector<account_name>(), "bob111111111" ) );
+   BOOST_REQUIRE( get_voter_info( "alice1111111" )["producer_ids"].as<vector<char>>().empty() );
+   BOOST_TEST_REQUIRE( 0 == get_producer_info( "defproducer3" )["total_votes"].as_double() );
+
+} FC_LOG_AND_RETHROW()
+
+BOOST_FIXTURE_TEST_CASE( vote_epoch_rebases_weights, eosio_system_tester, * boost::unit_test::tolerance(1e-10) ) try {
+   create_accounts_with_resources( { N(defproducer1), N(defproducer2) } );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer1", 1) );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer2", 2) );
+
+   issue( "alice1111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   issue( "bob111111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   BOOST_REQUIRE_EQUAL( success(), stake( "alice1111111", core_sym::from_string("30.0001"), core_sym::from_string("20.0001") ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), { N(defproducer1), N(defproducer2) } ) );
+   BOOST_REQUIRE_EQUAL( success(), stake( "bob111111111", core_sym::from_string("10.0000"), core_sym::from_string("10.0000") ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(bob111111111), { N(defproducer1) } ) );
+
+   //weights are relative to the current vote epoch, so they stay within a factor of two of the stake
+   const uint32_t epoch = get_global_state4()["vote_epoch"].as<uint32_t>();
+   BOOST_REQUIRE( 0 < epoch );
+   const double alice_weight = get_voter_info( "alice1111111" )["last_vote_weight"].as_double();
+   BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("50.0002")) == alice_weight );
+   BOOST_REQUIRE( alice_weight < 2 * core_sym::from_string("50.0002").get_amount() );
+   const double prod1_votes = get_producer_info( "defproducer1" )["total_votes"].as_double();
+   const double total_votes = get_current_global_state()["total_producer_vote_weight"].as_double();
+
+   //a year later a new epoch starts and the active producers are rebased to it
+   produce_block( fc::days(52 * 7) );
+   produce_blocks(2);
+   BOOST_REQUIRE_EQUAL( epoch + 1, get_global_state4()["vote_epoch"].as<uint32_t>() );
+   BOOST_REQUIRE_EQUAL( false, get_global_state4()["rebasing"].as<bool>() );
+   BOOST_REQUIRE_EQUAL( epoch + 1, get_producer_info( "defproducer1" )["vote_epoch"].as<uint32_t>() );
+   BOOST_TEST_REQUIRE( prod1_votes / 2 == get_producer_info( "defproducer1" )["total_votes"].as_double() );
+   BOOST_TEST_REQUIRE( total_votes / 2 == get_current_global_state()["total_producer_vote_weight"].as_double() );
+
+   //voters are rebased when they are next touched
+   BOOST_REQUIRE_EQUAL( epoch, get_voter_info( "bob111111111" )["vote_epoch"].as<uint32_t>() );
+   BOOST_REQUIRE_EQUAL( success(), stake( "bob111111111", core_sym::from_string("5.0000"), core_sym::from_string("5.0000") ) );
+   BOOST_REQUIRE_EQUAL( epoch + 1, get_voter_info( "bob111111111" )["vote_epoch"].as<uint32_t>() );
+   BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("30.0000")) == get_voter_info( "bob111111111" )["last_vote_weight"].as_double() );
+   BOOST_TEST_REQUIRE( alice_weight / 2 + stake2votes(core_sym::from_string("30.0000")) == get_producer_info( "defproducer1" )["total_votes"].as_double() );
+
+   //tallies and votes are rebased rounding down, so withdrawing every vote leaves the tally of a producer at no
+   //less than zero, and above it by less than a unit per voter
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), vector<account_name>() ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(bob111111111), vector<account_name>() ) );
+   const int64_t residue = get_producer_info( "defproducer1" )["total_vote_units"].as<int64_t>();
+   BOOST_REQUIRE( 0 <= residue && residue < 2 );
+
+} FC_LOG_AND_RETHROW()
+
+BOOST_FIXTURE_TEST_CASE( vote_counts_follow_votes, eosio_system_tester ) try {
+   create_accounts_with_resources( { N(defproducer1), N(defproducer2), N(defproducer3) } );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer1", 1) );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer2", 2) );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer3", 3) );
+
+   auto get_vote_count = [&]( const account_name& owner ) {
+      vector<char> data = get_row_by_account( config::system_account_name, config::system_account_name, N(votecounts), owner );
+      return data.empty() ? fc::variant() : abi_ser.binary_to_variant( "vote_count", data, abi_serializer_max_time );
+   };
+
+   //a chain started with this contract counts votes from the start
+   BOOST_REQUIRE_EQUAL( true, get_global_state4()["counts_built"].as<bool>() );
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg( "vote counts are already built" ),
+                        push_action( N(alice1111111), N(buildcounts), mvo()("max_voters", 10) ) );
+
+   issue( "alice1111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   issue( "bob111111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   issue( "carol1111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   BOOST_REQUIRE_EQUAL( success(), stake( "alice1111111", core_sym::from_string("30.0001"), core_sym::from_string("20.0001") ) );
+   BOOST_REQUIRE_EQUAL( success(), stake( "bob111111111", core_sym::from_string("10.0000"), core_sym::from_string("10.0000") ) );
+   BOOST_REQUIRE_EQUAL( success(), stake( "carol1111111", core_sym::from_string("10.0000"), core_sym::from_string("10.0000") ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), { N(defproducer1), N(defproducer2) } ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(bob111111111), { N(defproducer1) } ) );
+   BOOST_REQUIRE_EQUAL( 2, get_vote_count( N(defproducer1) )["voter_count"].as<uint32_t>() );
+   BOOST_REQUIRE_EQUAL( 1, get_vote_count( N(defproducer2) )["voter_count"].as<uint32_t>() );
+   BOOST_REQUIRE( get_vote_count( N(defproducer3) ).is_null() );
+
+   //changing a vote only counts the producers that were added or removed
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), { N(defproducer2), N(defproducer3) } ) );
+   BOOST_REQUIRE_EQUAL( 1, get_vote_count( N(defproducer1) )["voter_count"].as<uint32_t>() );
+   BOOST_REQUIRE_EQUAL( 1, get_vote_count( N(defproducer2) )["voter_count"].as<uint32_t>() );
+   BOOST_REQUIRE_EQUAL( 1, get_vote_count( N(defproducer3) )["voter_count"].as<uint32_t>() );
+
+   //delegating to a proxy moves the voter from its producers to the proxy
+   BOOST_REQUIRE_EQUAL( success(), push_action( N(carol1111111), N(regproxy), mvo()("proxy", "carol1111111")("isproxy", true) ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(bob111111111), vector<account_name>(), "carol1111111" ) );
+   BOOST_REQUIRE( get_vote_count( N(defproducer1) ).is_null() );
+   REQUIRE_MATCHING_OBJECT( mvo()("owner", "carol1111111")("voter_count", 0)("delegator_count", 1), get_vote_count( N(carol1111111) ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(bob111111111), { N(defproducer3) } ) );
+   BOOST_REQUIRE( get_vote_count( N(carol1111111) ).is_null() );
+   BOOST_REQUIRE_EQUAL( 2, get_vote_count( N(defproducer3) )["voter_count"].as<uint32_t>() );
+
+} FC_LOG_AND_RETHROW()
+
+BOOST_FIXTURE_TEST_CASE( refreshproxy_updates_delegators, eosio_system_tester, * boost::unit_test::tolerance(1e-10) ) try {
+   issue( "alice1111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   issue( "bob111111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   issue( "carol1111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   BOOST_REQUIRE_EQUAL( success(), push_action( N(alice1111111), N(regproxy), mvo()("proxy", "alice1111111")("isproxy", true) ) );
+   BOOST_REQUIRE_EQUAL( success(), stake( "bob111111111", core_sym::from_string("10.0000"), core_sym::from_string("10.0000") ) );
+   auto& rlm = control->get_resource_limits_manager();
+   const int64_t bob_ram_usage = rlm.get_account_ram_usage( N(bob111111111) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(bob111111111), vector<account_name>(), "alice1111111" ) );
+   BOOST_REQUIRE_EQUAL( success(), stake( "carol1111111", core_sym::from_string("20.0000"), core_sym::from_string("20.0000") ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(carol1111111), vector<account_name>(), "alice1111111" ) );
+
+   auto get_delegation = [&]( const account_name& owner ) {
+      vector<char> data = get_row_by_account( config::system_account_name, config::system_account_name, N(delegations), owner );
+      return data.empty() ? fc::variant() : abi_ser.binary_to_variant( "delegation", data, abi_serializer_max_time );
+   };
+   auto refreshproxy = [&]( const account_name& signer, const string& cursor, uint16_t limit ) {
+      return push_action( signer, N(refreshproxy), mvo()("proxy", "alice1111111")("cursor", cursor)("limit", limit) );
+   };
+
+   REQUIRE_MATCHING_OBJECT( mvo()("owner", "bob111111111")("proxy", "alice1111111"), get_delegation( N(bob111111111) ) );
+   REQUIRE_MATCHING_OBJECT( mvo()("owner", "carol1111111")("proxy", "alice1111111"), get_delegation( N(carol1111111) ) );
+   //the delegation is billed to the voter
+   BOOST_REQUIRE( bob_ram_usage < rlm.get_account_ram_usage( N(bob111111111) ) );
+   BOOST_REQUIRE_EQUAL( error("missing authority of alice1111111"), refreshproxy( N(bob111111111), "", 1 ) );
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg( "limit must be positive" ), refreshproxy( N(alice1111111), "", 0 ) );
+
+   //the weight of a delegator grows with time, refreshing one page only picks up the first delegator
+   produce_block( fc::days(14) );
+   produce_blocks(1);
+   const double carol_weight = get_voter_info( "carol1111111" )["last_vote_weight"].as_double();
+   BOOST_REQUIRE_EQUAL( success(), refreshproxy( N(alice1111111), "", 1 ) );
+   BOOST_TEST_REQUIRE( stake2votes( core_sym::from_string("20.0000") ) + carol_weight
+                       == get_voter_info( "alice1111111" )["proxied_vote_weight"].as_double() );
+
+   //the next page starts at the cursor
+   BOOST_REQUIRE_EQUAL( success(), refreshproxy( N(alice1111111), "carol1111111", 10 ) );
+   BOOST_TEST_REQUIRE( stake2votes( core_sym::from_string("60.0000") )
+                       == get_voter_info( "alice1111111" )["proxied_vote_weight"].as_double() );
+
+   //voting directly removes the delegation and refunds its RAM
+   BOOST_REQUIRE_EQUAL( success(), vote( N(bob111111111), vector<account_name>() ) );
+   BOOST_REQUIRE( get_delegation( N(bob111111111) ).is_null() );
+   BOOST_REQUIRE_EQUAL( bob_ram_usage, rlm.get_account_ram_usage( N(bob111111111) ) );
+
+} FC_LOG_AND_RETHROW()
+
+BOOST_FIXTURE_TEST_CASE( refreshvotes_updates_weights, eosio_system_tester, * boost::unit_test::tolerance(1e-10) ) try {
+   create_accounts_with_resources( { N(defproducer1), N(defproducer2), N(defproducer3) } );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer1", 1) );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer2", 2) );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer3", 3) );
+
+   issue( "alice1111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   issue( "bob111111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   issue( "carol1111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   BOOST_REQUIRE_EQUAL( success(), stake( "alice1111111", core_sym::from_string("30.0000"), core_sym::from_string("20.0000") ) );
+   BOOST_REQUIRE_EQUAL( success(), stake( "bob111111111", core_sym::from_string("10.0000"), core_sym::from_string("10.0000") ) );
+   BOOST_REQUIRE_EQUAL( success(), stake( "carol1111111", core_sym::from_string("10.0000"), core_sym::from_string("10.0000") ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), { N(defproducer1), N(defproducer2) } ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(bob111111111), { N(defproducer2), N(defproducer3) } ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(carol1111111), { N(defproducer3) } ) );
+
+   auto refreshvotes = [&]( const vector<account_name>& voters ) {
+      base_tester::push_action( config::system_account_name, N(refreshvotes), voters, mvo()("voters", voters) );
+      produce_block();
+   };
+
+   BOOST_REQUIRE_EQUAL( error("missing authority of bob111111111"),
+                        push_action( N(alice1111111), N(refreshvotes), mvo()("voters", vector<account_name>{ N(alice1111111), N(bob111111111) }) ) );
+
+   //weights cast two weeks ago are raised to the weight of the stake today
+   produce_block( fc::days(14) );
+   produce_blocks(1);
+   refreshvotes( { N(alice1111111), N(bob111111111) } );
+   BOOST_TEST_REQUIRE( stake2votes( core_sym::from_string("50.0000") ) == get_voter_info( "alice1111111" )["last_vote_weight"].as_double() );
+   BOOST_TEST_REQUIRE( stake2votes( core_sym::from_string("50.0000") ) == get_producer_info( "defproducer1" )["total_votes"].as_double() );
+   BOOST_TEST_REQUIRE( stake2votes( core_sym::from_string("70.0000") ) == get_producer_info( "defproducer2" )["total_votes"].as_double() );
+   //carol was not refreshed
+   BOOST_TEST_REQUIRE( stake2votes( core_sym::from_string("20.0000") ) + get_voter_info( "carol1111111" )["last_vote_weight"].as_double()
+                       == get_producer_info( "defproducer3" )["total_votes"].as_double() );
+
+   //only voters that voted can be refreshed
+   BOOST_REQUIRE_EQUAL( success(), vote( N(carol1111111), vector<account_name>() ) );
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg( "voter has no votes to refresh" ),
+                        push_action( N(carol1111111), N(refreshvotes), mvo()("voters", vector<account_name>{ N(carol1111111) }) ) );
+
+} FC_LOG_AND_RETHROW()
+
+BOOST_FIXTURE_TEST_CASE( onblock_refreshes_stale_votes, eosio_system_tester, * boost::unit_test::tolerance(1e-10) ) try {
+   create_accounts_with_resources( { N(defproducer1) } );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer1", 1) );
+   issue( "alice1111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   BOOST_REQUIRE_EQUAL( success(), stake( "alice1111111", core_sym::from_string("30.0000"), core_sym::from_string("20.0000") ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), { N(defproducer1) } ) );
+   const double cast_weight = get_producer_info( "defproducer1" )["total_votes"].as_double();
+
+   auto get_vote_age = [&]( const account_name& owner ) {
+      vector<char> data = get_row_by_account( config::system_account_name, config::system_account_name, N(voteages), owner );
+      return data.empty() ? fc::variant() : abi_ser.binary_to_variant( "vote_age", data, abi_serializer_max_time );
+   };
+   //voters are not tracked while refreshing is disabled
+   BOOST_REQUIRE( get_vote_age( N(alice1111111) ).is_null() );
+
+   BOOST_REQUIRE_EQUAL( error("missing authority of eosio"),
+                        push_action( N(alice1111111), N(setrefresh), mvo()("voters_per_block", 10) ) );
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg( "at most 20 voters can be refreshed per block" ),
+                        push_action( config::system_account_name, N(setrefresh), mvo()("voters_per_block", 21) ) );
+
+   //votes are not refreshed until a budget is set
+   produce_block( fc::days(14) );
+   produce_blocks(2);
+   BOOST_TEST_REQUIRE( cast_weight == get_producer_info( "defproducer1" )["total_votes"].as_double() );
+
+   auto& rlm = control->get_resource_limits_manager();
+   const int64_t alice_ram_usage = rlm.get_account_ram_usage( N(alice1111111) );
+   BOOST_REQUIRE_EQUAL( success(), push_action( config::system_account_name, N(setrefresh), mvo()("voters_per_block", 10) ) );
+   BOOST_REQUIRE_EQUAL( 10, get_global_state4()["vote_refreshes_per_block"].as<uint16_t>() );
+   BOOST_REQUIRE_EQUAL( true, get_global_state4()["aging"].as_bool() );
+
+   //onblock records the vote ages of voters that voted while refreshing was disabled, billed to the contract,
+   //and refreshes them first
+   produce_blocks(2);
+   BOOST_REQUIRE_EQUAL( false, get_global_state4()["aging"].as_bool() );
+   BOOST_REQUIRE( !get_vote_age( N(alice1111111) ).is_null() );
+   BOOST_TEST_REQUIRE( stake2votes( core_sym::from_string("50.0000") ) == get_producer_info( "defproducer1" )["total_votes"].as_double() );
+   BOOST_REQUIRE_EQUAL( alice_ram_usage, rlm.get_account_ram_usage( N(alice1111111) ) );
+
+   //a vote age created by a vote is billed to the voter
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), vector<account_name>() ) );
+   BOOST_REQUIRE( get_vote_age( N(alice1111111) ).is_null() );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), { N(defproducer1) } ) );
+   BOOST_REQUIRE( !get_vote_age( N(alice1111111) ).is_null() );
+   BOOST_REQUIRE( alice_ram_usage < rlm.get_account_ram_usage( N(alice1111111) ) );
+   const double recast_weight = get_producer_info( "defproducer1" )["total_votes"].as_double();
+
+   produce_block( fc::days(14) );
+   produce_blocks(2);
+   BOOST_TEST_REQUIRE( stake2votes( core_sym::from_string("50.0000") ) == get_producer_info( "defproducer1" )["total_votes"].as_double() );
+   BOOST_TEST_REQUIRE( stake2votes( core_sym::from_string("50.0000") ) == get_voter_info( "alice1111111" )["last_vote_weight"].as_double() );
+   BOOST_REQUIRE( recast_weight < get_producer_info( "defproducer1" )["total_votes"].as_double() );
+
+   //a voter that no longer votes is not tracked
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), vector<account_name>() ) );
+   BOOST_REQUIRE( get_vote_age( N(alice1111111) ).is_null() );
+
+} FC_LOG_AND_RETHROW()
+
+BOOST_FIXTURE_TEST_CASE( vote_events_record_vote_changes, eosio_system_tester ) try {
+   create_accounts_with_resources( { N(defproducer1), N(defproducer2) } );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer1", 1) );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer2", 2) );
+   issue( "alice1111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   BOOST_REQUIRE_EQUAL( success(), stake( "alice1111111", core_sym::from_string("30.0000"), core_sym::from_string("20.0000") ) );
+
+   auto get_vote_event = [&]( uint64_t seq ) {
+      vector<char> data = get_row_by_account( config::system_account_name, config::system_account_name, N(voteevents), account_name(seq % 1024) );
+      return data.empty() ? fc::variant() : abi_ser.binary_to_variant( "vote_event", data, abi_serializer_max_time );
+   };
+   auto to_units = [&]( double weight ) { return static_cast<int64_t>( eosiosystem::to_vote_units( weight ) ); };
+
+   const uint64_t seq = get_global_state4()["vote_event_seq"].as<uint64_t>();
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), { N(defproducer1), N(defproducer2) } ) );
+   BOOST_REQUIRE_EQUAL( seq + 2, get_global_state4()["vote_event_seq"].as<uint64_t>() );
+   const double weight = get_voter_info( "alice1111111" )["last_vote_weight"].as_double();
+   REQUIRE_MATCHING_OBJECT( mvo()("seq", seq)("voter", "alice1111111")("producer", "defproducer1"), get_vote_event( seq ) );
+   REQUIRE_MATCHING_OBJECT( mvo()("seq", seq + 1)("voter", "alice1111111")("producer", "defproducer2"), get_vote_event( seq + 1 ) );
+   BOOST_REQUIRE_EQUAL( to_units( weight ), get_vote_event( seq )["delta"].as<int64_t>() );
+
+   //removing a producer records a negative change, keeping one records nothing
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), { N(defproducer2) } ) );
+   BOOST_REQUIRE_EQUAL( seq + 3, get_global_state4()["vote_event_seq"].as<uint64_t>() );
+   REQUIRE_MATCHING_OBJECT( mvo()("seq", seq + 2)("voter", "alice1111111")("producer", "defproducer1"), get_vote_event( seq + 2 ) );
+   BOOST_REQUIRE_EQUAL( -to_units( weight ), get_vote_event( seq + 2 )["delta"].as<int64_t>() );
+
+   //a change of stake is recorded for every producer voted for
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), { N(defproducer1), N(defproducer2) } ) );
+   BOOST_REQUIRE_EQUAL( seq + 4, get_global_state4()["vote_event_seq"].as<uint64_t>() );
+   BOOST_REQUIRE_EQUAL( success(), stake( "alice1111111", core_sym::from_string("5.0000"), core_sym::from_string("5.0000") ) );
+   BOOST_REQUIRE_EQUAL( seq + 6, get_global_state4()["vote_event_seq"].as<uint64_t>() );
+   REQUIRE_MATCHING_OBJECT( mvo()("seq", seq + 4)("voter", "alice1111111")("producer", "defproducer1"), get_vote_event( seq + 4 ) );
+   REQUIRE_MATCHING_OBJECT( mvo()("seq", seq + 5)("voter", "alice1111111")("producer", "defproducer2"), get_vote_event( seq + 5 ) );
+   BOOST_REQUIRE( 0 < get_vote_event( seq + 4 )["delta"].as<int64_t>() );
+   BOOST_REQUIRE_EQUAL( get_vote_event( seq + 4 )["delta"].as<int64_t>(), get_vote_event( seq + 5 )["delta"].as<int64_t>() );
+
+} FC_LOG_AND_RETHROW()
+
+BOOST_FIXTURE_TEST_CASE( recalcvotes_rebuilds_tallies, eosio_system_tester, * boost::unit_test::tolerance(1e-10) ) try {
+   create_accounts_with_resources( { N(defproducer1), N(defproducer2), N(defproducer3) } );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer1", 1) );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer2", 2) );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer3", 3) );
+
+   issue( "alice1111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   issue( "bob111111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   BOOST_REQUIRE_EQUAL( success(), stake( "alice1111111", core_sym::from_string("30.0001"), core_sym::from_string("20.0001") ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), { N(defproducer1), N(defproducer2) } ) );
+   BOOST_REQUIRE_EQUAL( success(), stake( "bob111111111", core_sym::from_string("100.0002"), core_sym::from_string("50.0001") ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(bob111111111), { N(defproducer2), N(defproducer3) } ) );
+
+   auto recalcvotes = [&]( const account_name& signer, const string& cursor, uint32_t limit ) {
+      return push_action( signer, N(recalcvotes), mvo()("cursor", cursor)("limit", limit) );
+   };
+
+   BOOST_REQUIRE_EQUAL( error("missing authority of eosio"), recalcvotes( N(alice1111111), "", 1 ) );
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg( "limit must be positive" ), recalcvotes( config::system_account_name, "", 0 ) );
+
+   //start the recalculation, only part of the voters are summed
+   BOOST_REQUIRE_EQUAL( success(), recalcvotes( config::system_account_name, "", 1 ) );
+   BOOST_REQUIRE_EQUAL( 1, get_global_state4()["recalc_phase"].as<uint32_t>() );
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg( "cursor does not match the recalculation in progress" ),
+                        recalcvotes( config::system_account_name, "", 1 ) );
+
+   //votes keep changing while the recalculation is in progress
+   BOOST_REQUIRE_EQUAL( success(), stake( "alice1111111", core_sym::from_string("10.0000"), core_sym::from_string("10.0000") ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(bob111111111), { N(defproducer1), N(defproducer3) } ) );
+
+   for( int i = 0; i < 100 && get_global_state4()["recalc_phase"].as<uint32_t>() != 0; ++i ) {
+      BOOST_REQUIRE_EQUAL( success(), recalcvotes( config::system_account_name, get_global_state4()["recalc_cursor"].as_string(), 1 ) );
+      if( i == 0 ) {
+         BOOST_REQUIRE_EQUAL( success(), stake( "bob111111111", core_sym::from_string("5.0000"), core_sym::from_string("5.0000") ) );
+      }
+   }
+   BOOST_REQUIRE_EQUAL( 0, get_global_state4()["recalc_phase"].as<uint32_t>() );
+
+   const double alice_votes = stake2votes(core_sym::from_string("70.0002"));
+   const double bob_votes   = stake2votes(core_sym::from_string("160.0003"));
+   BOOST_TEST_REQUIRE( alice_votes + bob_votes == get_producer_info( "defproducer1" )["total_votes"].as_double() );
+   BOOST_TEST_REQUIRE( alice_votes == get_producer_info( "defproducer2" )["total_votes"].as_double() );
+   BOOST_TEST_REQUIRE( bob_votes == get_producer_info( "defproducer3" )["total_votes"].as_double() );
+   BOOST_TEST_REQUIRE( 2 * (alice_votes + bob_votes) == get_current_global_state()["total_producer_vote_weight"].as_double() );
+   BOOST_REQUIRE( get_row_by_account( config::system_account_name, config::system_account_name, N(votetally), N(defproducer1) ).empty() );
+
+} FC_LOG_AND_RETHROW()
+
+BOOST_FIXTURE_TEST_CASE( inactive_producers_keep_their_election_key, eosio_system_tester, * boost::unit_test::tolerance(1e-10) ) try {
+   create_accounts_with_resources( { N(defproducer1), N(defproducer2) } );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer1", 1) );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer2", 2) );
+
+   //prototalvote is the first secondary index of the producers table
+   auto election_key = [&]( const account_name& producer ) {
+      const auto& db  = control->db();
+      const auto* tbl = db.find<table_id_object, by_code_scope_table>(
+                           boost::make_tuple( config::system_account_name, config::system_account_name,
+                                              name( N(producers) & 0xFFFFFFFFFFFFFFF0ULL ) ) );
+      BOOST_REQUIRE( tbl );
+      const auto* obj = db.find<index_double_object, by_primary>( boost::make_tuple( tbl->id, producer.value ) );
+      BOOST_REQUIRE( obj );
+      double key;
+      memcpy( &key, &obj->secondary_key, sizeof(key) );
+      return key;
+   };
+
+   issue( "alice1111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   BOOST_REQUIRE_EQUAL( success(), stake( "alice1111111", core_sym::from_string("30.0001"), core_sym::from_string("20.0001") ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), { N(defproducer1), N(defproducer2) } ) );
+   BOOST_TEST_REQUIRE( -get_producer_info( "defproducer1" )["total_votes"].as_double() == election_key( N(defproducer1) ) );
+   BOOST_TEST_REQUIRE( -get_producer_info( "defproducer2" )["total_votes"].as_double() == election_key( N(defproducer2) ) );
+
+   //deactivated producers sort after every active one, and their vote changes leave their key alone
+   BOOST_REQUIRE_EQUAL( success(), push_action( N(defproducer2), N(unregprod), mvo()("producer", "defproducer2") ) );
+   BOOST_REQUIRE_EQUAL( std::numeric_limits<double>::max(), election_key( N(defproducer2) ) );
+   const double inactive_votes = get_producer_info( "defproducer2" )["total_votes"].as_double();
+   BOOST_REQUIRE_EQUAL( success(), stake( "alice1111111", core_sym::from_string("10.0000"), core_sym::from_string("10.0000") ) );
+   BOOST_REQUIRE( inactive_votes < get_producer_info( "defproducer2" )["total_votes"].as_double() );
+   BOOST_REQUIRE_EQUAL( std::numeric_limits<double>::max(), election_key( N(defproducer2) ) );
+   BOOST_TEST_REQUIRE( -get_producer_info( "defproducer1" )["total_votes"].as_double() == election_key( N(defproducer1) ) );
+
+   //registering again ranks the producer by its current votes
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer2", 4) );
+   BOOST_TEST_REQUIRE( -get_producer_info( "defproducer2" )["total_votes"].as_double() == election_key( N(defproducer2) ) );
+
+} FC_LOG_AND_RETHROW()
+
+BOOST_FIXTURE_TEST_CASE( gcproducers_erases_idle_producers, eosio_system_tester ) try {
+   create_accounts_with_resources( { N(defproducer1), N(defproducer2), N(defproducer3) } );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer1", 1) );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer2", 2) );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer3", 3) );
+
+   //defproducer2 keeps a vote, defproducer3 stays registered
+   issue( "alice1111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   BOOST_REQUIRE_EQUAL( success(), stake( "alice1111111", core_sym::from_string("30.0001"), core_sym::from_string("20.0001") ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), { N(defproducer2) } ) );
+   BOOST_REQUIRE_EQUAL( success(), push_action( N(defproducer1), N(unregprod), mvo()("producer", "defproducer1") ) );
+   BOOST_REQUIRE_EQUAL( success(), push_action( N(defproducer2), N(unregprod), mvo()("producer", "defproducer2") ) );
+
+   auto gcproducers = [&]( const account_name& signer, uint16_t max_rows, uint32_t min_idle_days ) {
+      return push_action( signer, N(gcproducers), mvo()("lower_bound", "")("max_rows", max_rows)("min_idle_days", min_idle_days) );
+   };
+   auto producer_exists = [&]( const account_name& producer ) {
+      return !get_row_by_account( config::system_account_name, config::system_account_name, N(producers), producer ).empty();
+   };
+
+   BOOST_REQUIRE_EQUAL( error("missing authority of eosio"), gcproducers( N(alice1111111), 10, 30 ) );
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg( "max_rows must be positive" ), gcproducers( config::system_account_name, 0, 30 ) );
+
+   //nothing has been idle long enough yet
+   BOOST_REQUIRE_EQUAL( success(), gcproducers( config::system_account_name, 10, 30 ) );
+   BOOST_REQUIRE( producer_exists( N(defproducer1) ) );
+
+   produce_block( fc::days(31) );
+   BOOST_REQUIRE_EQUAL( success(), gcproducers( config::system_account_name, 10, 30 ) );
+   BOOST_REQUIRE( !producer_exists( N(defproducer1) ) );
+   BOOST_REQUIRE( producer_exists( N(defproducer2) ) );
+   BOOST_REQUIRE( producer_exists( N(defproducer3) ) );
+
+   //once its votes are gone the producer is erased as well
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), { N(defproducer3) } ) );
+   BOOST_REQUIRE_EQUAL( success(), gcproducers( config::system_account_name, 10, 30 ) );
+   BOOST_REQUIRE( !producer_exists( N(defproducer2) ) );
+   BOOST_REQUIRE( producer_exists( N(defproducer3) ) );
+
+   //an erased producer can register again
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer1", 1) );
+   BOOST_REQUIRE( get_producer_info( "defproducer1" )["is_active"].as<bool>() );
+
+} FC_LOG_AND_RETHROW()
+
 BOOST_FIXTURE_TEST_CASE( vote_both_proxy_and_producers, eosio_system_tester ) try {
    //alice1111111 becomes a proxy
    BOOST_REQUIRE_EQUAL( success(), push_action( N(alice1111111), N(regproxy), mvo()
@@ -2842,6 +3679,165 @@ BOOST_FIXTURE_TEST_CASE( elect_producers /*_and_parameters*/, eosio_system_teste
 
 } FC_LOG_AND_RETHROW()
 
+BOOST_FIXTURE_TEST_CASE( schedule_ordered_by_location, eosio_system_tester ) try {
+   create_accounts_with_resources( {  N(defproducer1), N(defproducer2), N(defproducer3) } );
+   auto regproducer_at = [&]( const account_name& acnt, uint16_t location ) {
+      return push_action( acnt, N(regproducer), mvo()
+                          ("producer",  acnt )
+                          ("producer_key", get_public_key( acnt, "active" ) )
+                          ("url", "" )
+                          ("location", location )
+      );
+   };
+   BOOST_REQUIRE_EQUAL( success(), regproducer_at( N(defproducer1), 3 ) );
+   BOOST_REQUIRE_EQUAL( success(), regproducer_at( N(defproducer2), 1 ) );
+   BOOST_REQUIRE_EQUAL( success(), regproducer_at( N(defproducer3), 1 ) );
+
+   //stake more than 15% of total EOS supply to activate chain
+   transfer( "eosio", "alice1111111", core_sym::from_string("600000000.0000"), "eosio" );
+   BOOST_REQUIRE_EQUAL( success(), stake( "alice1111111", "alice1111111", core_sym::from_string("300000000.0000"), core_sym::from_string("300000000.0000") ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), { N(defproducer1), N(defproducer2), N(defproducer3) } ) );
+
+   auto check_schedule = [&]( const vector<account_name>& expected ) {
+      auto producer_keys = control->head_block_state()->active_schedule.producers;
+      BOOST_REQUIRE_EQUAL( expected.size(), producer_keys.size() );
+      for( size_t i = 0; i < expected.size(); ++i )
+         BOOST_REQUIRE_EQUAL( name(expected[i]), producer_keys[i].producer_name );
+   };
+
+   //producers are ordered by name by default
+   produce_blocks(250);
+   check_schedule( { N(defproducer1), N(defproducer2), N(defproducer3) } );
+
+   BOOST_REQUIRE_EQUAL( error("missing authority of eosio"),
+                        push_action( N(alice1111111), N(setschedmode), mvo()("schedule_order", 1) ) );
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg( "unknown schedule order" ),
+                        push_action( config::system_account_name, N(setschedmode), mvo()("schedule_order", 2) ) );
+
+   //ordered by location, producers at the same location are ordered by name
+   BOOST_REQUIRE_EQUAL( success(), push_action( config::system_account_name, N(setschedmode), mvo()("schedule_order", 1) ) );
+   produce_blocks(250);
+   check_schedule( { N(defproducer2), N(defproducer3), N(defproducer1) } );
+
+   //a producer that moves changes its place
+   BOOST_REQUIRE_EQUAL( success(), regproducer_at( N(defproducer3), 0 ) );
+   produce_blocks(250);
+   check_schedule( { N(defproducer3), N(defproducer2), N(defproducer1) } );
+
+   //back to ordering by name
+   BOOST_REQUIRE_EQUAL( success(), push_action( config::system_account_name, N(setschedmode), mvo()("schedule_order", 0) ) );
+   produce_blocks(250);
+   check_schedule( { N(defproducer1), N(defproducer2), N(defproducer3) } );
+
+} FC_LOG_AND_RETHROW()
+
+BOOST_FIXTURE_TEST_CASE( schedule_size_is_configurable, eosio_system_tester ) try {
+   create_accounts_with_resources( {  N(defproducer1), N(defproducer2), N(defproducer3) } );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer1", 1) );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer2", 2) );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer3", 3) );
+
+   //stake more than 15% of total EOS supply to activate chain
+   transfer( "eosio", "alice1111111", core_sym::from_string("600000000.0000"), "eosio" );
+   BOOST_REQUIRE_EQUAL( success(), stake( "alice1111111", "alice1111111", core_sym::from_string("300000000.0000"), core_sym::from_string("300000000.0000") ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), { N(defproducer1), N(defproducer2), N(defproducer3) } ) );
+   issue( "bob111111111", core_sym::from_string("80000.0000"),  config::system_account_name );
+   BOOST_REQUIRE_EQUAL( success(), stake( "bob111111111", core_sym::from_string("40000.0000"), core_sym::from_string("40000.0000") ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(bob111111111), { N(defproducer2), N(defproducer3) } ) );
+   produce_blocks(250);
+   BOOST_REQUIRE_EQUAL( 3, control->head_block_state()->active_schedule.producers.size() );
+
+   BOOST_REQUIRE_EQUAL( 21, get_global_state4()["schedule_size"].as<uint16_t>() );
+   BOOST_REQUIRE_EQUAL( 120, get_global_state4()["schedule_update_slots"].as<uint32_t>() );
+   auto setelection = [&]( const account_name& signer, uint16_t size, uint32_t slots ) {
+      return push_action( signer, N(setelection), mvo()("schedule_size", size)("update_slots", slots) );
+   };
+   BOOST_REQUIRE_EQUAL( error("missing authority of eosio"), setelection( N(alice1111111), 2, 240 ) );
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg( "schedule size must be between 1 and 21" ), setelection( config::system_account_name, 0, 240 ) );
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg( "schedule size must be between 1 and 21" ), setelection( config::system_account_name, 22, 240 ) );
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg( "elections must be between one minute and one day apart" ),
+                        setelection( config::system_account_name, 2, 119 ) );
+   BOOST_REQUIRE_EQUAL( wasm_assert_msg( "elections must be between one minute and one day apart" ),
+                        setelection( config::system_account_name, 2, 2 * 24 * 3600 + 1 ) );
+
+   //lowering the size shrinks the schedule to the producers with the most votes
+   BOOST_REQUIRE_EQUAL( success(), setelection( config::system_account_name, 2, 240 ) );
+   produce_blocks(500);
+   auto producer_keys = control->head_block_state()->active_schedule.producers;
+   BOOST_REQUIRE_EQUAL( 2, producer_keys.size() );
+   BOOST_REQUIRE_EQUAL( name("defproducer2"), producer_keys[0].producer_name );
+   BOOST_REQUIRE_EQUAL( name("defproducer3"), producer_keys[1].producer_name );
+
+   //elections follow the configured interval
+   auto last_update = [&]() { return get_current_global_state()["last_producer_schedule_update"].as_string(); };
+   const auto previous_update = last_update();
+   for( int i = 0; i < 250 && last_update() == previous_update; ++i )
+      produce_block();
+   const auto election = last_update();
+   BOOST_REQUIRE( election != previous_update );
+   produce_blocks(240);
+   BOOST_REQUIRE_EQUAL( election, last_update() );
+   produce_blocks(1);
+   BOOST_REQUIRE( election != last_update() );
+
+} FC_LOG_AND_RETHROW()
+
+BOOST_FIXTURE_TEST_CASE( per_block_counters_in_global5, eosio_system_tester ) try {
+   auto hot = [&]( const string& field ) { return get_global_state5()[field].as_string(); };
+
+   //wait for an election, which refreshes the copies in global and global2
+   const auto previous_update = hot("last_producer_schedule_update");
+   for( int i = 0; i < 250 && hot("last_producer_schedule_update") == previous_update; ++i )
+      produce_block();
+   const auto election = hot("last_producer_schedule_update");
+   BOOST_REQUIRE( election != previous_update );
+   BOOST_REQUIRE_EQUAL( election, get_global_state()["last_producer_schedule_update"].as_string() );
+   BOOST_REQUIRE_EQUAL( hot("last_block_num"), get_global_state2()["last_block_num"].as_string() );
+
+   //onblock only writes global5 until the next election
+   const auto last_block = hot("last_block_num");
+   produce_blocks(10);
+   BOOST_REQUIRE( last_block != hot("last_block_num") );
+   BOOST_REQUIRE_EQUAL( last_block, get_global_state2()["last_block_num"].as_string() );
+   BOOST_REQUIRE_EQUAL( election, get_global_state()["last_producer_schedule_update"].as_string() );
+
+} FC_LOG_AND_RETHROW()
+
+BOOST_FIXTURE_TEST_CASE( round_blocks_counted_in_global5, eosio_system_tester ) try {
+   create_accounts_with_resources( {  N(defproducer1), N(defproducer2) } );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer1", 1) );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer2", 2) );
+
+   //stake more than 15% of total EOS supply to activate chain
+   transfer( "eosio", "alice1111111", core_sym::from_string("600000000.0000"), "eosio" );
+   BOOST_REQUIRE_EQUAL( success(), stake( "alice1111111", "alice1111111", core_sym::from_string("300000000.0000"), core_sym::from_string("300000000.0000") ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), { N(defproducer1) } ) );
+   produce_blocks(250);
+   BOOST_REQUIRE_EQUAL( name("defproducer1"), control->head_block_state()->active_schedule.producers[0].producer_name );
+
+   auto stored_unpaid_blocks = [&]( const account_name& act ) { return get_producer_info( act )["unpaid_blocks"].as<uint32_t>(); };
+
+   //blocks of the current round are counted in global5 without writing the producers row
+   const uint32_t stored = stored_unpaid_blocks( N(defproducer1) );
+   const uint32_t unpaid = get_current_producer_info( "defproducer1" )["unpaid_blocks"].as<uint32_t>();
+   produce_blocks(10);
+   BOOST_REQUIRE_EQUAL( unpaid + 10, get_current_producer_info( "defproducer1" )["unpaid_blocks"].as<uint32_t>() );
+   BOOST_REQUIRE_EQUAL( stored, stored_unpaid_blocks( N(defproducer1) ) );
+   BOOST_REQUIRE_EQUAL( get_current_producer_info( "defproducer1" )["unpaid_blocks"].as<uint32_t>(),
+                        get_current_global_state()["total_unpaid_blocks"].as<uint32_t>() );
+
+   //proposing a new schedule adds them to the producers row
+   issue( "bob111111111", core_sym::from_string("80000.0000"),  config::system_account_name );
+   BOOST_REQUIRE_EQUAL( success(), stake( "bob111111111", core_sym::from_string("40000.0000"), core_sym::from_string("40000.0000") ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(bob111111111), { N(defproducer2) } ) );
+   produce_blocks(250);
+   BOOST_REQUIRE_EQUAL( 2, control->head_block_state()->active_schedule.producers.size() );
+   BOOST_REQUIRE( unpaid + 10 < stored_unpaid_blocks( N(defproducer1) ) );
+   BOOST_REQUIRE_EQUAL( get_current_producer_info( "defproducer1" )["unpaid_blocks"].as<uint32_t>() + get_current_producer_info( "defproducer2" )["unpaid_blocks"].as<uint32_t>(),
+                        get_current_global_state()["total_unpaid_blocks"].as<uint32_t>() );
+
+} FC_LOG_AND_RETHROW()
+
 
 BOOST_FIXTURE_TEST_CASE( buyname, eosio_system_tester ) try {
    create_accounts_with_resources( { N(dan), N(sam) } );
@@ -2970,7 +3966,7 @@ BOOST_FIXTURE_TEST_CASE( multiple_namebids, eosio_system_tester ) try {
 
    // stake enough to go above the 15% threshold
    stake_with_transfer( config::system_account_name, "alice", core_sym::from_string( "10000000.0000" ), core_sym::from_string( "10000000.0000" ) );
-   BOOST_REQUIRE_EQUAL(0, get_producer_info("producer")["unpaid_blocks"].as<uint32_t>());
+   BOOST_REQUIRE_EQUAL(0, get_current_producer_info("producer")["unpaid_blocks"].as<uint32_t>());
    BOOST_REQUIRE_EQUAL( success(), vote( N(alice), { N(producer) } ) );
 
    // need to wait for 14 days after going live
@@ -3035,6 +4031,34 @@ BOOST_FIXTURE_TEST_CASE( multiple_namebids, eosio_system_tester ) try {
 
 } FC_LOG_AND_RETHROW()
 
+BOOST_FIXTURE_TEST_CASE( highest_bid_cached_in_global4, eosio_system_tester ) try {
+   std::vector<account_name> accounts = { N(alice), N(bob) };
+   create_accounts_with_resources( accounts );
+   for ( const auto& a: accounts ) {
+      transfer( config::system_account_name, a, core_sym::from_string( "10000.0000" ) );
+   }
+   auto check_top_bid = [&]( const string& newname, int64_t amount ) {
+      const auto gs4 = get_global_state4();
+      BOOST_REQUIRE_EQUAL( newname, gs4["top_bid_name"].as_string() );
+      BOOST_REQUIRE_EQUAL( amount, gs4["top_bid"].as<int64_t>() );
+   };
+   check_top_bid( "", 0 );
+
+   BOOST_REQUIRE_EQUAL( success(), bidname( "alice", "prefb", core_sym::from_string("1.0000") ) );
+   check_top_bid( "prefb", 10000 );
+   //equal bids are ordered by name like in the highbid index
+   BOOST_REQUIRE_EQUAL( success(), bidname( "bob", "prefa", core_sym::from_string("1.0000") ) );
+   check_top_bid( "prefa", 10000 );
+   BOOST_REQUIRE_EQUAL( success(), bidname( "bob", "prefc", core_sym::from_string("0.5000") ) );
+   check_top_bid( "prefa", 10000 );
+   BOOST_REQUIRE_EQUAL( success(), bidname( "alice", "prefc", core_sym::from_string("2.0000") ) );
+   check_top_bid( "prefc", 20000 );
+   //outbidding the highest bid keeps it on top
+   BOOST_REQUIRE_EQUAL( success(), bidname( "bob", "prefc", core_sym::from_string("3.0000") ) );
+   check_top_bid( "prefc", 30000 );
+
+} FC_LOG_AND_RETHROW()
+
 BOOST_FIXTURE_TEST_CASE( namebid_pending_winner, eosio_system_tester ) try {
    cross_15_percent_threshold();
    produce_block( fc::hours(14*24) );    //wait 14 day for name auction activation
@@ -3050,6 +4074,146 @@ BOOST_FIXTURE_TEST_CASE( namebid_pending_winner, eosio_system_tester ) try {
    create_account_with_resources( N(prefb), N(bob111111111) );
 } FC_LOG_AND_RETHROW()
 
+BOOST_FIXTURE_TEST_CASE( unchanged_schedule_not_reproposed, eosio_system_tester ) try {
+   create_accounts_with_resources( {  N(defproducer1), N(defproducer2) } );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer1", 1) );
+   BOOST_REQUIRE_EQUAL( success(), regproducer( "defproducer2", 2) );
+
+   //stake more than 15% of total EOS supply to activate chain
+   transfer( "eosio", "alice1111111", core_sym::from_string("600000000.0000"), "eosio" );
+   BOOST_REQUIRE_EQUAL( success(), stake( "alice1111111", "alice1111111", core_sym::from_string("300000000.0000"), core_sym::from_string("300000000.0000") ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), { N(defproducer1) } ) );
+   produce_blocks(250);
+   auto producer_keys = control->head_block_state()->active_schedule.producers;
+   BOOST_REQUIRE_EQUAL( 1, producer_keys.size() );
+   const auto schedule_version = control->head_block_state()->active_schedule.version;
+   const auto first_hash = get_global_state4()["last_proposed_schedule_hash"].as_string();
+
+   //overwrites the fingerprint of the last proposal in the stored global4 row
+   auto set_schedule_hash = [&]( const string& hash ) {
+      auto& db = const_cast<chainbase::database&>( control->db() );
+      const auto* tbl = db.find<table_id_object, by_code_scope_table>(
+                           boost::make_tuple( config::system_account_name, config::system_account_name, N(global4) ) );
+      BOOST_REQUIRE( tbl );
+      const auto* obj = db.find<key_value_object, by_scope_primary>( boost::make_tuple( tbl->id, N(global4) ) );
+      BOOST_REQUIRE( obj );
+      fc::mutable_variant_object state( get_global_state4().get_object() );
+      state["last_proposed_schedule_hash"] = hash;
+      const auto data = abi_ser.variant_to_binary( "eosio_global_state4", state, abi_serializer_max_time );
+      db.modify( *obj, [&]( auto& o ) {
+            o.value.assign( data.data(), data.size() );
+         });
+   };
+
+   // several schedule updates pass without any change in the elected set
+   produce_blocks(500);
+   BOOST_REQUIRE_EQUAL( first_hash, get_global_state4()["last_proposed_schedule_hash"].as_string() );
+   BOOST_REQUIRE_EQUAL( schedule_version, control->head_block_state()->active_schedule.version );
+
+   // right after an upgrade there is no fingerprint, the set is refused as it is already active and is remembered anyway
+   set_schedule_hash( string( 64, '0' ) );
+   produce_blocks(250);
+   BOOST_REQUIRE_EQUAL( first_hash, get_global_state4()["last_proposed_schedule_hash"].as_string() );
+   BOOST_REQUIRE_EQUAL( schedule_version, control->head_block_state()->active_schedule.version );
+
+   // a change of the elected set is proposed and remembered
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), { N(defproducer1), N(defproducer2) } ) );
+   produce_blocks(250);
+   producer_keys = control->head_block_state()->active_schedule.producers;
+   BOOST_REQUIRE_EQUAL( 2, producer_keys.size() );
+   BOOST_REQUIRE_EQUAL( name("defproducer2"), producer_keys[1].producer_name );
+   BOOST_REQUIRE( first_hash != get_global_state4()["last_proposed_schedule_hash"].as_string() );
+
+   // a producer changing its key changes the fingerprint as well
+   const auto second_hash = get_global_state4()["last_proposed_schedule_hash"].as_string();
+   BOOST_REQUIRE_EQUAL( success(), push_action( N(defproducer2), N(regproducer), mvo()
+                                               ("producer",  "defproducer2")
+                                               ("producer_key", get_public_key( N(defproducer2), "owner" ) )
+                                               ("url", "")
+                                               ("location", 0)
+                        )
+   );
+   produce_blocks(250);
+   BOOST_REQUIRE( second_hash != get_global_state4()["last_proposed_schedule_hash"].as_string() );
+   producer_keys = control->head_block_state()->active_schedule.producers;
+   BOOST_REQUIRE( get_public_key( N(defproducer2), "owner" ) == producer_keys[1].block_signing_key );
+
+   // the fingerprint alone decides: while it is that of defproducer1 alone, electing defproducer1 alone proposes nothing
+   const auto schedule_version2 = control->head_block_state()->active_schedule.version;
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), { N(defproducer1) } ) );
+   set_schedule_hash( first_hash );
+   produce_blocks(250);
+   BOOST_REQUIRE_EQUAL( schedule_version2, control->head_block_state()->active_schedule.version );
+   BOOST_REQUIRE_EQUAL( 2, control->head_block_state()->active_schedule.producers.size() );
+
+} FC_LOG_AND_RETHROW()
+
+BOOST_FIXTURE_TEST_CASE( vote_swap_cpu_benchmark, eosio_system_tester, * boost::unit_test::tolerance(1e-10) ) try {
+   // 60 producers, split into the two sets of 30 the voter swaps between
+   std::vector<account_name> producer_names;
+   {
+      const std::string root("benchprod");
+      for ( char c = 'a'; c <= 'z'; ++c ) {
+         producer_names.emplace_back(root + "a" + std::string(1, c));
+         producer_names.emplace_back(root + "b" + std::string(1, c));
+      }
+      for ( char c = 'a'; c <= 'h'; ++c ) {
+         producer_names.emplace_back(root + "c" + std::string(1, c));
+      }
+      std::sort( producer_names.begin(), producer_names.end() );
+   }
+   setup_producer_accounts(producer_names);
+   for (const auto& p: producer_names) {
+      BOOST_REQUIRE_EQUAL( success(), regproducer(p) );
+   }
+   produce_block();
+
+   const std::vector<account_name> first_set( producer_names.begin(), producer_names.begin() + 30 );
+   const std::vector<account_name> second_set( producer_names.begin() + 30, producer_names.end() );
+
+   issue( "alice1111111", core_sym::from_string("1000.0000"),  config::system_account_name );
+   BOOST_REQUIRE_EQUAL( success(), stake( "alice1111111", core_sym::from_string("100.0000"), core_sym::from_string("100.0000") ) );
+   BOOST_REQUIRE_EQUAL( success(), vote( N(alice1111111), first_set ) );
+   produce_block();
+
+   // casts the votes in turn, each in its own block, and returns the average elapsed and billed cpu in us
+   auto measure = [&]( const std::vector<std::vector<account_name>>& votes ) {
+      int64_t  total_elapsed = 0;
+      uint64_t total_billed  = 0;
+      for( const auto& producers : votes ) {
+         auto trace = base_tester::push_action( config::system_account_name, N(voteproducer), N(alice1111111), mvo()
+                                                ("voter",     "alice1111111")
+                                                ("proxy",     name(0))
+                                                ("producers", producers)
+                                              );
+         BOOST_REQUIRE( trace && trace->receipt );
+         total_elapsed += trace->elapsed.count();
+         total_billed  += trace->receipt->cpu_usage_us;
+         produce_block();
+      }
+      return std::make_pair( total_elapsed / int64_t(votes.size()), total_billed / votes.size() );
+   };
+
+   const size_t rounds = 10;
+   std::vector<std::vector<account_name>> swaps, toggles;
+   for( size_t i = 0; i < rounds; ++i ) {
+      swaps.push_back( i % 2 == 0 ? second_set : first_set );
+      toggles.push_back( i % 2 == 0 ? std::vector<account_name>() : first_set );
+   }
+   const auto swap   = measure( swaps );
+   // the baseline adds or removes a single set, so it touches the 30 producers of one side of a swap
+   const auto toggle = measure( toggles );
+   BOOST_TEST_MESSAGE( "30 producer vote swap: " << swap.first << " us elapsed, " << swap.second << " us billed; "
+                       << "30 producer vote or unvote: " << toggle.first << " us elapsed, " << toggle.second << " us billed; "
+                       << "on average over " << rounds << " votes each" );
+   // a swap costs about two one-sided votes, building the deltas must stay linear in the number of producers
+   BOOST_REQUIRE( swap.first < 3 * toggle.first );
+
+   BOOST_TEST_REQUIRE( stake2votes(core_sym::from_string("200.0000")) == get_producer_info( first_set[0] )["total_votes"].as_double() );
+   BOOST_TEST_REQUIRE( 0 == get_producer_info( second_set[0] )["total_votes"].as_double() );
+
+} FC_LOG_AND_RETHROW()
+
 BOOST_FIXTURE_TEST_CASE( vote_producers_in_and_out, eosio_system_tester ) try {
 
    const asset net = core_sym::from_string("80.0000");
@@ -3093,13 +4257,13 @@ BOOST_FIXTURE_TEST_CASE( vote_producers_in_and_out, eosio_system_tester ) try {
       produce_blocks(23 * 12 + 20);
       bool all_21_produced = true;
       for (uint32_t i = 0; i < 21; ++i) {
-         if (0 == get_producer_info(producer_names[i])["unpaid_blocks"].as<uint32_t>()) {
+         if (0 == get_current_producer_info(producer_names[i])["unpaid_blocks"].as<uint32_t>()) {
             all_21_produced = false;
          }
       }
       bool rest_didnt_produce = true;
       for (uint32_t i = 21; i < producer_names.size(); ++i) {
-         if (0 < get_producer_info(producer_names[i])["unpaid_blocks"].as<uint32_t>()) {
+         if (0 < get_current_producer_info(producer_names[i])["unpaid_blocks"].as<uint32_t>()) {
             rest_didnt_produce = false;
          }
       }
@@ -3112,12 +4276,12 @@ BOOST_FIXTURE_TEST_CASE( vote_producers_in_and_out, eosio_system_tester ) try {
       const uint32_t new_prod_index  = 23;
       BOOST_REQUIRE_EQUAL(success(), stake("producvoterd", core_sym::from_string("40000000.0000"), core_sym::from_string("40000000.0000")));
       BOOST_REQUIRE_EQUAL(success(), vote(N(producvoterd), { producer_names[new_prod_index] }));
-      BOOST_REQUIRE_EQUAL(0, get_producer_info(producer_names[new_prod_index])["unpaid_blocks"].as<uint32_t>());
+      BOOST_REQUIRE_EQUAL(0, get_current_producer_info(producer_names[new_prod_index])["unpaid_blocks"].as<uint32_t>());
       produce_blocks(4 * 12 * 21);
-      BOOST_REQUIRE(0 < get_producer_info(producer_names[new_prod_index])["unpaid_blocks"].as<uint32_t>());
-      const uint32_t initial_unpaid_blocks = get_producer_info(producer_names[voted_out_index])["unpaid_blocks"].as<uint32_t>();
+      BOOST_REQUIRE(0 < get_current_producer_info(producer_names[new_prod_index])["unpaid_blocks"].as<uint32_t>());
+      const uint32_t initial_unpaid_blocks = get_current_producer_info(producer_names[voted_out_index])["unpaid_blocks"].as<uint32_t>();
       produce_blocks(2 * 12 * 21);
-      BOOST_REQUIRE_EQUAL(initial_unpaid_blocks, get_producer_info(producer_names[voted_out_index])["unpaid_blocks"].as<uint32_t>());
+      BOOST_REQUIRE_EQUAL(initial_unpaid_blocks, get_current_producer_info(producer_names[voted_out_index])["unpaid_blocks"].as<uint32_t>());
       produce_block(fc::hours(24));
       BOOST_REQUIRE_EQUAL(success(), vote(N(producvoterd), { producer_names[voted_out_index] }));
       produce_blocks(2 * 12 * 21);